@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "error.h"
+
+/*
+ * Initialise an arena with no memory. Nothing is allocated until
+ * reserve_arena() is called
+ */
+void init_arena(struct Arena *arena) {
+    memset(arena, 0, sizeof(*arena));
+}
+
+/*
+ * Free the memory of an arena, and everything allocated from it
+ */
+void free_arena(struct Arena *arena) {
+    free(arena->memory);
+    init_arena(arena);
+}
+
+/*
+ * Return the room an allocation of size bytes takes up in an arena, including
+ * the padding that keeps the next one aligned
+ */
+size_t arena_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+/*
+ * Empty an arena, and make sure it has room for size bytes of allocations
+ * (as counted by arena_size()). Everything allocated from it before is
+ * released. Return 1 if successful, 0 otherwise
+ */
+int reserve_arena(struct Arena *arena, size_t size) {
+    arena->used = 0;
+    if (size <= arena->capacity) {
+        return 1;
+    }
+
+    free(arena->memory);
+    arena->capacity = arena_size(size);
+    arena->memory = aligned_alloc(ARENA_ALIGNMENT, arena->capacity);
+    if (arena->memory == NULL) {
+        print_error("Failed to allocate memory for the arena");
+        arena->capacity = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Allocate size bytes from an arena. The memory is not cleared. Return NULL if
+ * there is not enough room left
+ */
+void *arena_alloc(struct Arena *arena, size_t size) {
+    size = arena_size(size);
+    if (size > arena->capacity - arena->used) {
+        return NULL;
+    }
+
+    void *memory = arena->memory + arena->used;
+    arena->used += size;
+    return memory;
+}
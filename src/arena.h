@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Every allocation from an arena starts on a multiple of this many bytes
+#define ARENA_ALIGNMENT 64
+
+/*
+ * A block of memory that allocations are carved from in order and released
+ * all at once. reserve_arena() empties the arena, and only allocates if it
+ * needs more room than it has ever had, so once it has grown to the largest
+ * size asked for, emptying and refilling it allocates nothing
+ */
+struct Arena {
+    unsigned char *memory;
+    size_t capacity;
+    size_t used;
+};
+
+void init_arena(struct Arena *arena);
+void free_arena(struct Arena *arena);
+size_t arena_size(size_t size);
+int reserve_arena(struct Arena *arena, size_t size);
+void *arena_alloc(struct Arena *arena, size_t size);
+
+#endif
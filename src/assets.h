@@ -0,0 +1,17 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+/*
+ * A file from the assets directory, compiled into the executable. The table
+ * of assets is generated at build time by embed-assets (see the Makefile)
+ */
+struct Asset {
+    const char *name;  // The file name, e.g. "flag.png"
+    const unsigned char *data;
+    long size;
+};
+
+extern const struct Asset assets[];
+extern const int asset_count;
+
+#endif
@@ -0,0 +1,1237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "minesweeper.h"
+#include "solver.h"
+#include "probability.h"
+#include "threadpool.h"
+#include "generator.h"
+#include "endless.h"
+#include "savefile.h"
+#include "rng.h"
+#include "error.h"
+
+// Default timing parameters. These can be changed on the command line
+#define DEFAULT_WARMUP_TIME 0.05  // Seconds spent warming up each benchmark
+#define DEFAULT_MIN_TIME 0.02     // Minimum length of each repetition
+#define DEFAULT_REPETITIONS 5
+
+// The seed used for every board, so that runs are comparable
+#define BENCH_SEED 1
+
+// The time allowed to generate each no-guess board, as in the game
+#define GENERATE_TIME_BUDGET 0.1
+
+// The mine density of the endless board. This is the lowest allowed, which
+// gives the biggest openings
+#define ENDLESS_BENCH_DENSITY ENDLESS_MIN_DENSITY
+
+// A checkerboard of revealed cells on a board this size joins its unknown
+// cells into a component just under MAX_COMPONENT_CELLS, with too many
+// arrangements to enumerate. Working out its probabilities must take no
+// longer than TANGLED_MAX_TIME seconds
+#define TANGLED_SIZE 14
+#define TANGLED_MINES 49
+#define TANGLED_MAX_TIME 1.0
+
+#define MAX_BENCH_RESULTS 128
+#define MAX_REPETITIONS 100
+
+struct BoardSize {
+    const char *name;
+    int width;
+    int height;
+    int mine_count;
+
+    // Only benchmark the engine's own operations, not the solver, which
+    // would take too long on boards this big
+    int engine_only;
+};
+
+// The presets from handle_click() followed by large custom boards, up to the
+// largest board allowed at the same density as "huge"
+struct BoardSize board_sizes[] = {
+    {"small", 8, 8, 10, 0},
+    {"medium", 16, 16, 30, 0},
+    {"large", 30, 16, 99, 0},
+    {"custom-dense", 99, 99, 1960, 0},
+    {"custom-sparse", 99, 99, 10, 0},
+    {"huge", 2000, 2000, 640000, 1},
+    {"max", MAX_WIDTH, MAX_HEIGHT, MAX_WIDTH * MAX_HEIGHT / 25 * 4, 1}
+};
+
+// Endless boards have no size or mine count
+struct BoardSize endless_size = {"endless", 0, 0, 0, 1};
+
+/*
+ * The player-visible state of a game, which is restored between operations
+ * that change it
+ */
+struct Snapshot {
+    unsigned char *cells;
+    size_t cells_size;
+    int cells_revealed;
+    int flags_remaining;
+    int mine_exploded;
+};
+
+/*
+ * A single benchmark: an operation on a game, and optionally a reset that
+ * undoes it. The time taken by the reset is measured separately and
+ * subtracted, so only the operation itself is reported. Resets only undo what
+ * the operation changed, so that they stay small next to it
+ */
+struct BenchCase {
+    const char *name;
+    struct BoardSize *size;
+    struct Game game;
+    struct Snapshot snapshot;
+
+    int x;  // The cell that the operation acts on
+    int y;
+
+    // The number of cells the operation processes, for reporting cells/s. This
+    // is 0 if cells/s is not meaningful for the operation
+    int cells_per_op;
+
+    void (*op)(struct BenchCase *bench);
+    void (*reset)(struct BenchCase *bench);
+
+    // Used by operations that play whole games
+    struct Solver solver;
+    struct Rng rng;
+
+    // Used by operations that compute mine probabilities
+    struct ProbabilityEngine probability;
+    double *probabilities;
+
+    // Used by operations that generate boards. Each board is generated from
+    // the next seed
+    struct Generator generator;
+    uint64_t next_seed;
+
+    // Used by operations that start games in an arena
+    struct Arena arena;
+
+    // Used by operations on endless boards, instead of game
+    struct EndlessGame endless;
+};
+
+struct BenchResult {
+    const char *name;
+    struct BoardSize *size;
+    double median_ns;  // Median ns/op over the repetitions
+    double min_ns;     // Fastest repetition in ns/op
+    int cells_per_op;
+};
+
+struct BenchOptions {
+    double warmup_time;
+    double min_time;
+    int repetitions;
+    int json;
+};
+
+struct BenchResult results[MAX_BENCH_RESULTS];
+int result_count = 0;
+
+// The number of benchmarks that could not be timed against their reset
+int failed_count = 0;
+
+// Shared by every benchmark that computes mine probabilities
+struct ThreadPool pool;
+
+// Results of operations are written here so they cannot be optimised away
+volatile int bench_sink;
+
+// The file used by the save and load benchmarks. It is removed on exit
+char save_path[] = "/tmp/minesweeper-bench-XXXXXX";
+
+/*
+ * Return the current time in seconds from a monotonic clock
+ */
+double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Return the start of the memory holding a game's cells, including the border
+ * around the grid
+ */
+unsigned char *get_cell_buffer(struct Game *game) {
+    return game->cells - game->stride - 1;
+}
+
+/*
+ * Store the player-visible state of a game in a snapshot
+ */
+void take_snapshot(struct Game *game, struct Snapshot *snapshot) {
+    // Whether a cell has been drawn is not part of the state
+    clear_dirty_cells(game);
+
+    snapshot->cells_size = sizeof(*game->cells) * game->stride *
+                           (game->height + 2);
+    snapshot->cells = malloc(snapshot->cells_size);
+    memcpy(snapshot->cells, get_cell_buffer(game), snapshot->cells_size);
+    snapshot->cells_revealed = game->cells_revealed;
+    snapshot->flags_remaining = game->flags_remaining;
+    snapshot->mine_exploded = game->mine_exploded;
+}
+
+/*
+ * Put a game back into the state stored in a snapshot
+ */
+void restore_snapshot(struct Game *game, struct Snapshot *snapshot) {
+    memcpy(get_cell_buffer(game), snapshot->cells, snapshot->cells_size);
+    game->cells_revealed = snapshot->cells_revealed;
+    game->flags_remaining = snapshot->flags_remaining;
+    game->mine_exploded = snapshot->mine_exploded;
+
+    // The renderer would have drawn the changed cells by the next operation
+    clear_dirty_cells(game);
+}
+
+/*
+ * Return 1 if the cell x, y contains a mine, 0 otherwise
+ */
+int cell_is_mine(struct Game *game, int x, int y) {
+    int position = x + y * game->width;
+    return (game->mine_bits[position / 64] >> (position % 64)) & 1;
+}
+
+/*
+ * Count the mines adjacent to a cell the way the engine used to, by testing
+ * each of the 8 neighbours in turn. Used as the baseline for the kernel
+ */
+int reference_adjacent_mines(struct Game *game, int x, int y) {
+    int count = 0;
+    for (int dx=-1; dx<=1; dx++) {
+        for (int dy=-1; dy<=1; dy++) {
+            int nx = x + dx;
+            int ny = y + dy;
+
+            if ((dx == 0 && dy == 0) || nx < 0 || nx >= game->width ||
+                ny < 0 || ny >= game->height) {
+                continue;
+            }
+
+            count += cell_is_mine(game, nx, ny);
+        }
+    }
+
+    return count;
+}
+
+/*
+ * The recursive reveal that the engine used before reveal_cell() became
+ * iterative, kept as the baseline for the cascade benchmark
+ */
+void reference_reveal_cell(struct Game *game, int x, int y);
+
+void reference_reveal_neighbours(struct Game *game, int x, int y) {
+    for (int dx=-1; dx<=1; dx++) {
+        for (int dy=-1; dy<=1; dy++) {
+            int nx = x + dx;
+            int ny = y + dy;
+
+            if (nx < 0 || nx >= game->width || ny < 0 || ny >= game->height) {
+                continue;
+            }
+            if (get_cell(game, nx, ny) != CELL_TYPE_UNKNOWN) {
+                continue;
+            }
+
+            reference_reveal_cell(game, nx, ny);
+        }
+    }
+}
+
+void reference_reveal_cell(struct Game *game, int x, int y) {
+    game->cells_revealed++;
+    int n = reference_adjacent_mines(game, x, y);
+
+    // The cell already holds its count, so revealing it only sets a bit. It is
+    // added to the changed cells as reveal_cell() does, which the reset needs
+    int index = x + y * game->stride;
+    game->cells[index] |= CELL_REVEALED | CELL_DIRTY;
+    game->dirty_cells[game->dirty_count++] = index;
+
+    if (n == 0) {
+        reference_reveal_neighbours(game, x, y);
+    }
+}
+
+/*
+ * Operations and resets for the benchmarks
+ */
+void op_init_game(struct BenchCase *bench) {
+    struct BoardSize *size = bench->size;
+    free_game(&(bench->game));
+    init_game(&(bench->game), size->width, size->height, size->mine_count,
+              BENCH_SEED);
+}
+
+void op_init_game_in_arena(struct BenchCase *bench) {
+    struct BoardSize *size = bench->size;
+    free_game(&(bench->game));
+    init_game_in_arena(&(bench->game), &(bench->arena), size->width,
+                       size->height, size->mine_count, BENCH_SEED);
+}
+
+void op_reveal_cell(struct BenchCase *bench) {
+    reveal_cell(&(bench->game), bench->x, bench->y);
+}
+
+void op_reference_reveal_cell(struct BenchCase *bench) {
+    reference_reveal_cell(&(bench->game), bench->x, bench->y);
+}
+
+void op_chord(struct BenchCase *bench) {
+    reveal_neighobouring_cells(&(bench->game), bench->x, bench->y);
+}
+
+void op_toggle_flag(struct BenchCase *bench) {
+    toggle_flag(&(bench->game), bench->x, bench->y);
+}
+
+void op_game_over(struct BenchCase *bench) {
+    bench_sink = won_game(&(bench->game)) + lost_game(&(bench->game));
+}
+
+void op_solver_play(struct BenchCase *bench) {
+    struct SolverResult result;
+    solver_play(&(bench->solver), &(bench->game), &(bench->rng), &result);
+}
+
+void op_compute_probabilities(struct BenchCase *bench) {
+    compute_probabilities(&(bench->probability), &(bench->game),
+                          bench->probabilities);
+}
+
+void op_generate_no_guess(struct BenchCase *bench) {
+    struct BoardSize *size = bench->size;
+    struct GeneratorResult result;
+    generate_no_guess_game(&(bench->generator), &(bench->game),
+                           bench->next_seed++, size->width / 2,
+                           size->height / 2, GENERATE_TIME_BUDGET, &result);
+}
+
+void op_adjacent_counts(struct BenchCase *bench) {
+    compute_adjacent_counts(&(bench->game));
+}
+
+void op_reference_adjacent_counts(struct BenchCase *bench) {
+    struct Game *game = &(bench->game);
+    int sum = 0;
+    for (int y=0; y<game->height; y++) {
+        for (int x=0; x<game->width; x++) {
+            sum += reference_adjacent_mines(game, x, y);
+        }
+    }
+    bench_sink = sum;
+}
+
+void op_save_game(struct BenchCase *bench) {
+    save_game(&(bench->game), save_path);
+}
+
+void op_load_game(struct BenchCase *bench) {
+    struct Game game;
+    if (load_game(&game, save_path, 0)) {
+        free_game(&game);
+    }
+}
+
+void op_load_game_verified(struct BenchCase *bench) {
+    struct Game game;
+    if (load_game(&game, save_path, 1)) {
+        free_game(&game);
+    }
+}
+
+void op_endless_reveal_cell(struct BenchCase *bench) {
+    endless_reveal_cell(&(bench->endless), bench->x, bench->y);
+}
+
+void op_endless_first_reveal(struct BenchCase *bench) {
+    struct EndlessGame *game = &(bench->endless);
+    init_endless_game(game, BENCH_SEED, ENDLESS_BENCH_DENSITY);
+    endless_reveal_cell(game, bench->x, bench->y);
+    free_endless_game(game);
+}
+
+void op_endless_toggle_flag(struct BenchCase *bench) {
+    endless_toggle_flag(&(bench->endless), bench->x, bench->y);
+}
+
+/*
+ * Restore the cells that the operation changed, which the engine lists in the
+ * game's dirty cells, so the reset takes time in proportion to the operation
+ * rather than to the size of the board. The restored cells are not dirty, so
+ * emptying the list is enough to clear it
+ */
+void reset_changed_cells(struct BenchCase *bench) {
+    struct Game *game = &(bench->game);
+    struct Snapshot *snapshot = &(bench->snapshot);
+    int offset = game->stride + 1;
+
+    for (int i=0; i<game->dirty_count; i++) {
+        int index = game->dirty_cells[i];
+        game->cells[index] = snapshot->cells[index + offset];
+    }
+    game->dirty_count = 0;
+
+    game->cells_revealed = snapshot->cells_revealed;
+    game->flags_remaining = snapshot->flags_remaining;
+    game->mine_exploded = snapshot->mine_exploded;
+}
+
+/*
+ * Cover every cell of the endless board's chunks again, keeping the chunks, so
+ * that the next reveal does not include creating them
+ */
+void reset_endless_cells(struct BenchCase *bench) {
+    struct EndlessGame *game = &(bench->endless);
+    for (int i=0; i<game->chunk_capacity; i++) {
+        struct Chunk *chunk = game->chunk_table[i];
+        if (chunk == NULL) {
+            continue;
+        }
+        for (int j=0; j<CHUNK_CELLS; j++) {
+            chunk->cells[j] &= ~(CELL_REVEALED | CELL_FLAGGED);
+        }
+    }
+    game->cells_revealed = 0;
+    game->flags_placed = 0;
+}
+
+/*
+ * Run count iterations of the benchmark, with or without the operation, and
+ * return the time taken in seconds
+ */
+double time_iterations(struct BenchCase *bench, long count, int with_op) {
+    double start = get_time();
+    for (long i=0; i<count; i++) {
+        if (bench->reset != NULL) {
+            bench->reset(bench);
+        }
+        if (with_op) {
+            bench->op(bench);
+        }
+    }
+    return get_time() - start;
+}
+
+/*
+ * Return the number of iterations of the benchmark that take at least
+ * min_time seconds, doubling the count until they do
+ */
+long calibrate_iterations(struct BenchCase *bench, double min_time) {
+    long count = 1;
+    while (time_iterations(bench, count, 1) < min_time) {
+        count *= 2;
+    }
+    return count;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Warm up and time a benchmark, and record the result. An operation with a
+ * reset is only recorded if its time stands out from the reset's: every
+ * repetition must take longer with the operation than without it, by more
+ * than the reset's own times vary between repetitions. Otherwise the result
+ * would be noise, so an error is reported instead
+ */
+void run_bench(struct BenchCase *bench, struct BenchOptions *options) {
+    double start = get_time();
+    while (get_time() - start < options->warmup_time) {
+        time_iterations(bench, 16, 1);
+    }
+
+    long count = calibrate_iterations(bench, options->min_time);
+
+    double times[MAX_REPETITIONS];
+    double reset_times[MAX_REPETITIONS];
+    for (int i=0; i<options->repetitions; i++) {
+        double elapsed = time_iterations(bench, count, 1);
+        reset_times[i] = 0;
+        if (bench->reset != NULL) {
+            reset_times[i] = time_iterations(bench, count, 0) * 1e9 / count;
+        }
+        times[i] = elapsed * 1e9 / count - reset_times[i];
+    }
+    qsort(times, options->repetitions, sizeof(double), compare_doubles);
+    qsort(reset_times, options->repetitions, sizeof(double), compare_doubles);
+
+    double reset_spread = reset_times[options->repetitions - 1] -
+                          reset_times[0];
+    if (bench->reset != NULL &&
+        (times[0] <= 0 || times[options->repetitions / 2] <= reset_spread)) {
+        print_error("%s on %s: the operation (%.1f ns/op) cannot be told "
+                    "apart from its reset (%.1f ns/op)", bench->name,
+                    bench->size->name, times[options->repetitions / 2],
+                    reset_times[options->repetitions / 2]);
+        failed_count++;
+        return;
+    }
+
+    if (result_count == MAX_BENCH_RESULTS) {
+        print_error("Too many benchmark results");
+        exit_app(EXIT_FAILURE);
+    }
+
+    struct BenchResult *result = &results[result_count++];
+    result->name = bench->name;
+    result->size = bench->size;
+    result->median_ns = times[options->repetitions / 2];
+    result->min_ns = times[0];
+    result->cells_per_op = bench->cells_per_op;
+
+    if (!options->json) {
+        // Endless boards have no size or mine count
+        if (bench->size == &endless_size) {
+            printf("%-30s %-14s %7s %5s", result->name, bench->size->name,
+                   "-", "-");
+        }
+        else {
+            printf("%-30s %-14s %3dx%-3d %5d", result->name,
+                   bench->size->name, bench->size->width, bench->size->height,
+                   bench->size->mine_count);
+        }
+        printf(" %12.1f %12.1f", result->median_ns, result->min_ns);
+        if (result->cells_per_op > 0 && result->median_ns > 0) {
+            printf(" %14.0f", result->cells_per_op * 1e9 / result->median_ns);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Set up a benchmark case with a freshly initialised game
+ */
+void init_bench(struct BenchCase *bench, const char *name,
+                struct BoardSize *size) {
+    memset(bench, 0, sizeof(*bench));
+    bench->name = name;
+    bench->size = size;
+    if (!init_game(&(bench->game), size->width, size->height, size->mine_count,
+                   BENCH_SEED)) {
+        exit_app(EXIT_FAILURE);
+    }
+}
+
+void free_bench(struct BenchCase *bench) {
+    free_game(&(bench->game));
+    free_arena(&(bench->arena));
+    free_endless_game(&(bench->endless));
+    free(bench->snapshot.cells);
+    free_solver(&(bench->solver));
+    free_probability_engine(&(bench->probability));
+    free(bench->probabilities);
+    free_generator(&(bench->generator));
+}
+
+/*
+ * Find the cell with no adjacent mines whose opening is largest, and store it
+ * in x_ptr, y_ptr. Return the number of cells in the opening, or 0 if there
+ * are no cells without adjacent mines
+ */
+int find_largest_opening(struct Game *game, int *x_ptr, int *y_ptr) {
+    struct Snapshot snapshot;
+    take_snapshot(game, &snapshot);
+
+    int best = 0;
+    for (int y=0; y<game->height; y++) {
+        for (int x=0; x<game->width; x++) {
+            if (get_cell(game, x, y) != CELL_TYPE_UNKNOWN ||
+                cell_is_mine(game, x, y) || adjacent_mines(game, x, y) != 0) {
+                continue;
+            }
+
+            // Reveal the opening, leaving it revealed so that the other cells
+            // in it are skipped
+            int revealed = game->cells_revealed;
+            reveal_cell(game, x, y);
+            if (game->cells_revealed - revealed > best) {
+                best = game->cells_revealed - revealed;
+                *x_ptr = x;
+                *y_ptr = y;
+            }
+        }
+    }
+
+    restore_snapshot(game, &snapshot);
+    free(snapshot.cells);
+    return best;
+}
+
+/*
+ * Change the byte at offset in the save at save_path to value, and update the
+ * checksums to match, so that only load_game()'s checks of the data itself
+ * can tell. Return 1 if successful, 0 otherwise
+ */
+int corrupt_save(uint64_t offset, unsigned char value) {
+    FILE *file = fopen(save_path, "r+b");
+    if (file == NULL) {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    unsigned char *data = malloc(size);
+    rewind(file);
+    int ok = (data != NULL && fread(data, 1, size, file) == (size_t) size);
+    if (ok) {
+        struct SaveHeader *header = (struct SaveHeader *) data;
+        data[offset] = value;
+        header->data_checksum = save_checksum(0, data + header->cells_offset,
+                                              size - header->cells_offset);
+        header->header_checksum = save_checksum(0, header,
+            offsetof(struct SaveHeader, header_checksum));
+        rewind(file);
+        ok = (fwrite(data, 1, size, file) == (size_t) size);
+    }
+    free(data);
+    return fclose(file) == 0 && ok;
+}
+
+/*
+ * Return 1 if load_game() accepts the save at save_path, 0 otherwise. The
+ * error it prints for a save it rejects is hidden, as the corrupt saves are
+ * made on purpose
+ */
+int save_loads(int verify_data) {
+    fflush(stderr);
+    int saved_stderr = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+
+    struct Game game;
+    int loaded = load_game(&game, save_path, verify_data);
+    if (loaded) {
+        free_game(&game);
+    }
+
+    fflush(stderr);
+    if (saved_stderr >= 0) {
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+    }
+    return loaded;
+}
+
+/*
+ * Check that the engine's neighbour counts and cascade agree with the
+ * reference implementations for a board, and
+ * that its saves load back as they were and are rejected when corrupt
+ */
+void verify_engine(struct BoardSize *size) {
+    struct Game game;
+    if (!init_game(&game, size->width, size->height, size->mine_count,
+                   BENCH_SEED)) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    for (int y=0; y<game.height; y++) {
+        for (int x=0; x<game.width; x++) {
+            if (adjacent_mines(&game, x, y) !=
+                reference_adjacent_mines(&game, x, y)) {
+                print_error("Neighbour count mismatch at %d, %d", x, y);
+                exit_app(EXIT_FAILURE);
+            }
+            if (((game.cells[x + y * game.stride] & CELL_MINE) != 0) !=
+                cell_is_mine(&game, x, y)) {
+                print_error("Mine bit mismatch at %d, %d", x, y);
+                exit_app(EXIT_FAILURE);
+            }
+        }
+    }
+
+    int x, y;
+    if (find_largest_opening(&game, &x, &y) > 0) {
+        struct Snapshot initial;
+        take_snapshot(&game, &initial);
+
+        reference_reveal_cell(&game, x, y);
+        struct Snapshot expected;
+        take_snapshot(&game, &expected);
+
+        restore_snapshot(&game, &initial);
+        reveal_cell(&game, x, y);
+        clear_dirty_cells(&game);
+        if (game.cells_revealed != expected.cells_revealed ||
+            memcmp(get_cell_buffer(&game), expected.cells,
+                   expected.cells_size) != 0) {
+            print_error("Cascade reveals different cells to the recursion");
+            exit_app(EXIT_FAILURE);
+        }
+
+        free(initial.cells);
+        free(expected.cells);
+    }
+
+    // A saved game must load back exactly as it was
+    struct Snapshot saved;
+    take_snapshot(&game, &saved);
+    struct Game loaded;
+    if (!save_game(&game, save_path) || !load_game(&loaded, save_path, 1)) {
+        exit_app(EXIT_FAILURE);
+    }
+    if (memcmp(get_cell_buffer(&loaded), saved.cells, saved.cells_size) != 0 ||
+        memcmp(loaded.mines, game.mines, sizeof(int) * game.mine_count) != 0 ||
+        loaded.cells_revealed != game.cells_revealed ||
+        loaded.flags_remaining != game.flags_remaining ||
+        loaded.seed != game.seed) {
+        print_error("Loaded game differs from the saved one");
+        exit_app(EXIT_FAILURE);
+    }
+    free_game(&loaded);
+    free(saved.cells);
+
+    // A broken border must be caught on every load, and a mine missing from
+    // the cells when the data is verified
+    struct SaveHeader header;
+    int stride = game.width + 2;
+    if (!read_save_header(save_path, &header) ||
+        !corrupt_save(header.cells_offset, 0) || save_loads(0) ||
+        !save_game(&game, save_path) ||
+        !corrupt_save(header.cells_offset + stride + 1,
+                      get_cell_buffer(&game)[stride + 1] ^ CELL_MINE) ||
+        save_loads(1)) {
+        print_error("A corrupt save was not rejected");
+        exit_app(EXIT_FAILURE);
+    }
+
+    free_game(&game);
+}
+
+/*
+ * Count the cells around x, y (not including x, y itself) which do or do not
+ * contain a mine
+ */
+int count_neighbours(struct Game *game, int x, int y, int mines) {
+    int count = 0;
+    for (int dy=-1; dy<=1; dy++) {
+        for (int dx=-1; dx<=1; dx++) {
+            int nx = x + dx;
+            int ny = y + dy;
+            if ((dx != 0 || dy != 0) && nx >= 0 && nx < game->width &&
+                ny >= 0 && ny < game->height &&
+                cell_is_mine(game, nx, ny) == mines) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ * Set up a chord: find a numbered cell with at least one safe neighbour,
+ * reveal it and flag all of its adjacent mines. Return 1 if a cell was found
+ */
+int setup_chord(struct BenchCase *bench) {
+    struct Game *game = &(bench->game);
+
+    for (int y=0; y<game->height; y++) {
+        for (int x=0; x<game->width; x++) {
+            if (cell_is_mine(game, x, y) || adjacent_mines(game, x, y) == 0 ||
+                count_neighbours(game, x, y, 0) == 0) {
+                continue;
+            }
+
+            reveal_cell(game, x, y);
+            for (int dy=-1; dy<=1; dy++) {
+                for (int dx=-1; dx<=1; dx++) {
+                    int nx = x + dx;
+                    int ny = y + dy;
+                    if (nx >= 0 && nx < game->width && ny >= 0 &&
+                        ny < game->height && cell_is_mine(game, nx, ny)) {
+                        toggle_flag(game, nx, ny);
+                    }
+                }
+            }
+
+            bench->x = x;
+            bench->y = y;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Open the board at its largest opening and solve as far as possible without
+ * guessing. Return 1 if this leaves a position that needs a guess and whose
+ * probabilities can be computed, 0 otherwise
+ */
+int setup_stuck_position(struct BenchCase *bench) {
+    int x, y;
+    if (find_largest_opening(&(bench->game), &x, &y) == 0) {
+        return 0;
+    }
+    reveal_cell(&(bench->game), x, y);
+
+    struct SolverResult result;
+    memset(&result, 0, sizeof(result));
+    if (!init_solver(&(bench->solver), bench->size->width *
+                                       bench->size->height)) {
+        exit_app(EXIT_FAILURE);
+    }
+    solver_run(&(bench->solver), &(bench->game), &result);
+
+    return !won_game(&(bench->game)) &&
+           compute_probabilities(&(bench->probability), &(bench->game),
+                                 bench->probabilities);
+}
+
+/*
+ * Check that compute_probabilities() returns in good time on a component too
+ * tangled to enumerate. Revealing every other cell of a board in a
+ * checkerboard, apart from the mines, joins all of the unknown cells into one
+ * component through the numbers around them
+ */
+void verify_tangled_probabilities() {
+    struct Game game;
+    if (!init_game(&game, TANGLED_SIZE, TANGLED_SIZE, TANGLED_MINES,
+                   BENCH_SEED)) {
+        exit_app(EXIT_FAILURE);
+    }
+    for (int y=0; y<game.height; y++) {
+        for (int x=0; x<game.width; x++) {
+            unsigned char *cell = &(game.cells[x + y * game.stride]);
+            if ((x + y) % 2 == 0 && !(*cell & CELL_MINE)) {
+                *cell |= CELL_REVEALED;
+                game.cells_revealed++;
+            }
+        }
+    }
+
+    struct ProbabilityEngine engine;
+    int cells = game.width * game.height;
+    double *probabilities = malloc(sizeof(double) * cells);
+    if (probabilities == NULL ||
+        !init_probability_engine(&engine, cells, &pool)) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    double start = get_time();
+    int ok = compute_probabilities(&engine, &game, probabilities);
+    double elapsed = get_time() - start;
+    if (!ok || engine.component_count != 1 || elapsed > TANGLED_MAX_TIME) {
+        print_error("Probabilities of a tangled component took %.1f s, "
+                    "returning %d for %d components", elapsed, ok,
+                    engine.component_count);
+        exit_app(EXIT_FAILURE);
+    }
+    for (int i=0; i<cells; i++) {
+        if (probabilities[i] < 0 || probabilities[i] > 1) {
+            print_error("Probability %g out of range", probabilities[i]);
+            exit_app(EXIT_FAILURE);
+        }
+    }
+
+    free_probability_engine(&engine);
+    free(probabilities);
+    free_game(&game);
+}
+
+/*
+ * Run every benchmark for one board size
+ */
+void bench_board(struct BoardSize *size, struct BenchOptions *options) {
+    struct BenchCase bench;
+    int cells = size->width * size->height;
+
+    verify_engine(size);
+
+    // Board generation, including placing mines and counting neighbours, with
+    // the board's memory allocated each time or reused from an arena
+    init_bench(&bench, "init_game", size);
+    bench.op = op_init_game;
+    bench.cells_per_op = cells;
+    run_bench(&bench, options);
+    bench.name = "init_game_in_arena";
+    bench.op = op_init_game_in_arena;
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    // Neighbour counts on their own, and the per-cell baseline
+    init_bench(&bench, "adjacent_counts", size);
+    bench.op = op_adjacent_counts;
+    bench.cells_per_op = cells;
+    run_bench(&bench, options);
+    bench.name = "adjacent_counts_percell";
+    bench.op = op_reference_adjacent_counts;
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    // Revealing a single numbered cell
+    init_bench(&bench, "reveal_cell_single", size);
+    take_snapshot(&(bench.game), &(bench.snapshot));
+    for (int i=0; i<cells; i++) {
+        int x = i % size->width;
+        int y = i / size->width;
+        if (!cell_is_mine(&(bench.game), x, y) &&
+            adjacent_mines(&(bench.game), x, y) > 0) {
+            bench.x = x;
+            bench.y = y;
+            bench.op = op_reveal_cell;
+            bench.reset = reset_changed_cells;
+            bench.cells_per_op = 1;
+            run_bench(&bench, options);
+            break;
+        }
+    }
+    free_bench(&bench);
+
+    // The largest zero-cell cascade on the board, against the old recursion
+    init_bench(&bench, "reveal_cell_cascade", size);
+    bench.cells_per_op = find_largest_opening(&(bench.game), &bench.x,
+                                              &bench.y);
+    if (bench.cells_per_op > 0) {
+        take_snapshot(&(bench.game), &(bench.snapshot));
+        bench.op = op_reveal_cell;
+        bench.reset = reset_changed_cells;
+        run_bench(&bench, options);
+        bench.name = "reveal_cell_cascade_recursive";
+        bench.op = op_reference_reveal_cell;
+        run_bench(&bench, options);
+    }
+    free_bench(&bench);
+
+    // Chording on a numbered cell whose adjacent mines have all been flagged
+    init_bench(&bench, "reveal_neighobouring_cells", size);
+    if (setup_chord(&bench)) {
+        int before = bench.game.cells_revealed;
+        take_snapshot(&(bench.game), &(bench.snapshot));
+        op_chord(&bench);
+        bench.cells_per_op = bench.game.cells_revealed - before;
+        bench.op = op_chord;
+        bench.reset = reset_changed_cells;
+        run_bench(&bench, options);
+    }
+    free_bench(&bench);
+
+    // Toggling a flag. Each operation alternates between placing and removing
+    // the flag, so no reset is needed
+    init_bench(&bench, "toggle_flag", size);
+    bench.op = op_toggle_flag;
+    bench.cells_per_op = 1;
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    // Checking whether the game is over
+    init_bench(&bench, "won_game_lost_game", size);
+    bench.op = op_game_over;
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    // Saving the game, and loading it back by mapping the file, with and
+    // without checking all of its data
+    init_bench(&bench, "save_game", size);
+    bench.op = op_save_game;
+    bench.cells_per_op = cells;
+    run_bench(&bench, options);
+    bench.name = "load_game";
+    bench.op = op_load_game;
+    run_bench(&bench, options);
+    bench.name = "load_game_verified";
+    bench.op = op_load_game_verified;
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    if (size->engine_only) {
+        return;
+    }
+
+    // Playing a whole game with the solver, from the first click to the end.
+    // The guesses differ between iterations, so this is an average over many
+    // games on the same board
+    init_bench(&bench, "solver_play", size);
+    if (!init_solver(&(bench.solver), cells)) {
+        exit_app(EXIT_FAILURE);
+    }
+    rng_seed(&(bench.rng), BENCH_SEED);
+    take_snapshot(&(bench.game), &(bench.snapshot));
+    bench.op = op_solver_play;
+    bench.reset = reset_changed_cells;
+    run_bench(&bench, options);
+
+    // The same, guessing by mine probability
+    if (!init_probability_engine(&(bench.probability), cells, &pool)) {
+        exit_app(EXIT_FAILURE);
+    }
+    bench.name = "solver_play_probability";
+    bench.solver.probability = &(bench.probability);
+    rng_seed(&(bench.rng), BENCH_SEED);
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    // Generating boards that need no guesses, each from a different seed. If
+    // no board is found within the time budget then the time taken is the
+    // budget
+    init_bench(&bench, "generate_no_guess", size);
+    if (!init_generator(&(bench.generator), cells, &pool)) {
+        exit_app(EXIT_FAILURE);
+    }
+    bench.next_seed = BENCH_SEED;
+    bench.op = op_generate_no_guess;
+    bench.cells_per_op = cells;
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    // Mine probabilities for the position where the solver first gets stuck
+    init_bench(&bench, "compute_probabilities", size);
+    bench.probabilities = malloc(sizeof(double) * cells);
+    if (bench.probabilities == NULL ||
+        !init_probability_engine(&(bench.probability), cells, &pool)) {
+        exit_app(EXIT_FAILURE);
+    }
+    if (setup_stuck_position(&bench)) {
+        bench.cells_per_op = bench.probability.var_count;
+        bench.op = op_compute_probabilities;
+        run_bench(&bench, options);
+    }
+    else if (!options->json) {
+        printf("%-30s %-14s skipped, the solver never gets stuck\n",
+               bench.name, size->name);
+    }
+    free_bench(&bench);
+}
+
+/*
+ * Check that every cell of the endless board's chunks holds the mine and count
+ * that the hash gives, and that the cascade from x, y revealed no mines and
+ * stopped only at numbered cells. The opening crosses the corner of 4 chunks
+ * at 0, 0, so this covers the cascade between chunks
+ */
+void verify_endless(int x, int y) {
+    struct EndlessGame game;
+    if (!init_endless_game(&game, BENCH_SEED, ENDLESS_BENCH_DENSITY) ||
+        !endless_reveal_cell(&game, x, y)) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    long revealed = 0;
+    for (int i=0; i<game.chunk_capacity; i++) {
+        struct Chunk *chunk = game.chunk_table[i];
+        if (chunk == NULL) {
+            continue;
+        }
+
+        for (int j=0; j<CHUNK_CELLS; j++) {
+            int cx = chunk->x * CHUNK_SIZE + j % CHUNK_SIZE;
+            int cy = chunk->y * CHUNK_SIZE + j / CHUNK_SIZE;
+            unsigned char cell = chunk->cells[j];
+
+            if ((cell & CELL_COUNT_MASK) != endless_adjacent_mines(&game, cx, cy) ||
+                ((cell & CELL_MINE) != 0) != endless_is_mine(&game, cx, cy)) {
+                print_error("Endless chunk mismatch at %d, %d", cx, cy);
+                exit_app(EXIT_FAILURE);
+            }
+            if (!(cell & CELL_REVEALED)) {
+                continue;
+            }
+            revealed++;
+
+            int unknown = 0;
+            for (int dy=-1; dy<=1; dy++) {
+                for (int dx=-1; dx<=1; dx++) {
+                    unknown += (endless_get_cell(&game, cx + dx, cy + dy) ==
+                                CELL_TYPE_UNKNOWN);
+                }
+            }
+            if ((cell & CELL_MINE) ||
+                ((cell & CELL_COUNT_MASK) == 0 && unknown > 0)) {
+                print_error("Endless cascade stopped wrongly at %d, %d", cx, cy);
+                exit_app(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (revealed != game.cells_revealed) {
+        print_error("Endless cascade revealed %ld cells but counted %ld",
+                    revealed, game.cells_revealed);
+        exit_app(EXIT_FAILURE);
+    }
+
+    free_endless_game(&game);
+}
+
+/*
+ * Run the benchmarks for an endless board, starting from 0, 0 as a player
+ * would
+ */
+void bench_endless(struct BenchOptions *options) {
+    struct BenchCase bench;
+
+    verify_endless(0, 0);
+
+    // The opening from 0, 0 on a board whose chunks already exist
+    memset(&bench, 0, sizeof(bench));
+    bench.name = "endless_reveal_cascade";
+    bench.size = &endless_size;
+    if (!init_endless_game(&(bench.endless), BENCH_SEED,
+                           ENDLESS_BENCH_DENSITY) ||
+        !endless_reveal_cell(&(bench.endless), 0, 0)) {
+        exit_app(EXIT_FAILURE);
+    }
+    bench.cells_per_op = bench.endless.cells_revealed;
+    bench.op = op_endless_reveal_cell;
+    bench.reset = reset_endless_cells;
+    run_bench(&bench, options);
+
+    if (!options->json) {
+        printf("%-30s %-14s %d cells revealed in %d chunks, %zu KB\n",
+               "endless_memory", bench.size->name, bench.cells_per_op,
+               bench.endless.chunk_count,
+               endless_memory_usage(&(bench.endless)) / 1024);
+    }
+
+    // Toggling a flag in a chunk that exists. Each operation alternates
+    // between placing and removing the flag
+    bench.name = "endless_toggle_flag";
+    bench.x = CHUNK_SIZE / 2;
+    bench.y = CHUNK_SIZE / 2;
+    bench.cells_per_op = 1;
+    bench.op = op_endless_toggle_flag;
+    bench.reset = NULL;
+    run_bench(&bench, options);
+    free_bench(&bench);
+
+    // A new board up to and including the opening from 0, 0, which creates
+    // the chunks it covers
+    memset(&bench, 0, sizeof(bench));
+    bench.name = "endless_first_reveal";
+    bench.size = &endless_size;
+    bench.op = op_endless_first_reveal;
+    run_bench(&bench, options);
+    free_bench(&bench);
+}
+
+/*
+ * Print the recorded results as a JSON document
+ */
+void print_json(struct BenchOptions *options) {
+    printf("{\n");
+    printf("  \"adjacent_counts_kernel\": \"%s\",\n", adjacent_counts_kernel());
+    printf("  \"seed\": %d,\n", BENCH_SEED);
+    printf("  \"threads\": %d,\n", pool.thread_count);
+    printf("  \"warmup_time\": %g,\n", options->warmup_time);
+    printf("  \"min_time\": %g,\n", options->min_time);
+    printf("  \"repetitions\": %d,\n", options->repetitions);
+    printf("  \"results\": [\n");
+
+    for (int i=0; i<result_count; i++) {
+        struct BenchResult *result = &results[i];
+        double cells_per_second = 0;
+        if (result->cells_per_op > 0 && result->median_ns > 0) {
+            cells_per_second = result->cells_per_op * 1e9 / result->median_ns;
+        }
+
+        printf("    {\"name\": \"%s\", \"board\": \"%s\", \"width\": %d, "
+               "\"height\": %d, \"mine_count\": %d, \"ns_per_op\": %.3f, "
+               "\"min_ns_per_op\": %.3f, \"cells_per_op\": %d, "
+               "\"cells_per_second\": %.0f}%s\n",
+               result->name, result->size->name, result->size->width,
+               result->size->height, result->size->mine_count,
+               result->median_ns, result->min_ns, result->cells_per_op,
+               cells_per_second, (i < result_count - 1 ? "," : ""));
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+}
+
+void print_usage() {
+    fprintf(stderr,
+            "usage: minesweeper-bench [--json] [--repetitions N] "
+            "[--min-time SECONDS] [--warmup SECONDS] [--threads N]\n");
+}
+
+int main(int argc, char **args) {
+    struct BenchOptions options;
+    options.warmup_time = DEFAULT_WARMUP_TIME;
+    options.min_time = DEFAULT_MIN_TIME;
+    options.repetitions = DEFAULT_REPETITIONS;
+    options.json = 0;
+    int thread_count = 0;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(args[i], "--json") == 0) {
+            options.json = 1;
+        }
+        else if (strcmp(args[i], "--repetitions") == 0 && i + 1 < argc) {
+            options.repetitions = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--min-time") == 0 && i + 1 < argc) {
+            options.min_time = atof(args[++i]);
+        }
+        else if (strcmp(args[i], "--warmup") == 0 && i + 1 < argc) {
+            options.warmup_time = atof(args[++i]);
+        }
+        else if (strcmp(args[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(args[++i]);
+        }
+        else {
+            print_usage();
+            exit_app(EXIT_FAILURE);
+        }
+    }
+
+    if (options.repetitions < 1 || options.repetitions > MAX_REPETITIONS) {
+        print_error("Repetitions must be between 1 and %d", MAX_REPETITIONS);
+        exit_app(EXIT_FAILURE);
+    }
+
+    int fd = mkstemp(save_path);
+    if (fd < 0) {
+        print_error("Failed to create a file to save games to");
+        exit_app(EXIT_FAILURE);
+    }
+    close(fd);
+
+    // 0 threads means one per core
+    if (thread_count < 0 || !init_thread_pool(&pool, thread_count)) {
+        print_error("Failed to start %d threads", thread_count);
+        exit_app(EXIT_FAILURE);
+    }
+
+    if (!options.json) {
+        printf("Neighbour counts use the %s kernel, and probabilities use "
+               "%d threads\n\n", adjacent_counts_kernel(), pool.thread_count);
+        printf("%-30s %-14s %7s %5s %12s %12s %14s\n", "benchmark", "board",
+               "size", "mines", "ns/op", "min ns/op", "cells/s");
+    }
+
+    verify_tangled_probabilities();
+
+    int count = sizeof(board_sizes) / sizeof(board_sizes[0]);
+    for (int i=0; i<count; i++) {
+        bench_board(&board_sizes[i], &options);
+    }
+    bench_endless(&options);
+
+    if (options.json) {
+        print_json(&options);
+    }
+
+    free_thread_pool(&pool);
+    remove(save_path);
+    return (failed_count == 0 ? 0 : EXIT_FAILURE);
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Build tool: write a C source file to stdout that contains each file given
+ * on the command line as a byte array, and a table of them by file name (see
+ * assets.h). This lets the game load its assets from memory instead of disk
+ */
+
+#define BYTES_PER_LINE 16
+
+/*
+ * Return the part of path after the last '/'
+ */
+const char *get_file_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return (slash != NULL ? slash + 1 : path);
+}
+
+/*
+ * Write the contents of the file at path as a byte array called name. Return
+ * the size of the file, or -1 if it could not be read or is empty, as C has
+ * no empty arrays
+ */
+long write_array(const char *path, const char *name) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "embed-assets: Failed to open %s\n", path);
+        return -1;
+    }
+
+    int c = fgetc(file);
+    if (c == EOF) {
+        fprintf(stderr, "embed-assets: %s is empty\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    // The arrays are aligned so that they can be read as any type in place
+    printf("static const unsigned char %s[] __attribute__((aligned(16))) = {",
+           name);
+
+    long size = 0;
+    for (; c != EOF; c = fgetc(file)) {
+        if (size % BYTES_PER_LINE == 0) {
+            printf("\n    ");
+        }
+        printf("0x%02x,", c);
+        size++;
+    }
+    printf("\n};\n\n");
+
+    int ok = !ferror(file);
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "embed-assets: Failed to read %s\n", path);
+        return -1;
+    }
+    return size;
+}
+
+int main(int argc, char **args) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: embed-assets FILE...\n");
+        return EXIT_FAILURE;
+    }
+
+    long *sizes = malloc(sizeof(long) * argc);
+    if (sizes == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    printf("// Generated by embed-assets - do not edit\n\n");
+    printf("#include \"assets.h\"\n\n");
+
+    for (int i=1; i<argc; i++) {
+        char name[32];
+        sprintf(name, "asset_%d", i - 1);
+        sizes[i] = write_array(args[i], name);
+        if (sizes[i] < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("const struct Asset assets[] = {\n");
+    for (int i=1; i<argc; i++) {
+        printf("    {\"%s\", asset_%d, %ld},\n", get_file_name(args[i]), i - 1,
+               sizes[i]);
+    }
+    printf("};\n\n");
+    printf("const int asset_count = %d;\n", argc - 1);
+
+    free(sizes);
+    return 0;
+}
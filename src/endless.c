@@ -0,0 +1,477 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "minesweeper.h"
+#include "endless.h"
+#include "rng.h"
+#include "error.h"
+
+// The mask of the cell coordinates within a chunk
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+
+#define INITIAL_CHUNK_CAPACITY 64
+#define INITIAL_REVEAL_STACK_CAPACITY 1024
+
+// The offsets in a chunk's cells from a cell to each of its 8 neighbours, for
+// cells that are not on the edge of the chunk
+static const int neighbour_offsets[8] = {
+    -CHUNK_SIZE - 1, -CHUNK_SIZE, -CHUNK_SIZE + 1,
+    -1, 1,
+    CHUNK_SIZE - 1, CHUNK_SIZE, CHUNK_SIZE + 1
+};
+
+/*
+ * Return a well mixed 64-bit hash of value, using the splitmix64 output
+ * function
+ */
+static uint64_t hash64(uint64_t value) {
+    return splitmix64(&value);
+}
+
+/*
+ * Return the hash table slot to start looking for the chunk at cx, cy from
+ */
+static int chunk_slot(struct EndlessGame *game, int cx, int cy) {
+    uint64_t key = ((uint64_t) (uint32_t) cx << 32) | (uint32_t) cy;
+    return hash64(key) & (game->chunk_capacity - 1);
+}
+
+/*
+ * Initialise an endless board with the given seed and fraction of cells that
+ * are mines. Return 1 if successful, 0 otherwise
+ */
+int init_endless_game(struct EndlessGame *game, uint64_t seed, double density) {
+    memset(game, 0, sizeof(*game));
+
+    if (density < ENDLESS_MIN_DENSITY || density > ENDLESS_MAX_DENSITY) {
+        print_error("Mine density must be between %g and %g",
+                    ENDLESS_MIN_DENSITY, ENDLESS_MAX_DENSITY);
+        return 0;
+    }
+
+    game->seed = hash64(seed);
+    game->density = density;
+    game->mine_threshold = density * 4294967296.0;
+
+    game->chunk_capacity = INITIAL_CHUNK_CAPACITY;
+    game->chunk_table = calloc(game->chunk_capacity, sizeof(struct Chunk *));
+    game->reveal_stack_capacity = INITIAL_REVEAL_STACK_CAPACITY;
+    game->reveal_stack = malloc(sizeof(struct ChunkCell) *
+                                game->reveal_stack_capacity);
+    if (game->chunk_table == NULL || game->reveal_stack == NULL) {
+        print_error("Failed to allocate memory for the endless game");
+        free_endless_game(game);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Free the chunks and other memory used by an endless board
+ */
+void free_endless_game(struct EndlessGame *game) {
+    if (game->chunk_table != NULL) {
+        for (int i=0; i<game->chunk_capacity; i++) {
+            free(game->chunk_table[i]);
+        }
+    }
+    free(game->chunk_table);
+    free(game->reveal_stack);
+    memset(game, 0, sizeof(*game));
+}
+
+/*
+ * Return 1 if the cell x, y is a mine, 0 otherwise. This is a pure function
+ * of the seed and the coordinates, so it is the same whenever it is called
+ */
+int endless_is_mine(struct EndlessGame *game, int x, int y) {
+    if (x >= -1 && x <= 1 && y >= -1 && y <= 1) {
+        return 0;
+    }
+
+    uint64_t key = ((uint64_t) (uint32_t) x << 32) | (uint32_t) y;
+    return (hash64(hash64(key) ^ game->seed) >> 32) < game->mine_threshold;
+}
+
+/*
+ * Return the chunk at cx, cy, or NULL if it has not been created
+ */
+static struct Chunk *find_chunk(struct EndlessGame *game, int cx, int cy) {
+    struct Chunk *chunk = game->last_chunk;
+    if (chunk != NULL && chunk->x == cx && chunk->y == cy) {
+        return chunk;
+    }
+
+    int mask = game->chunk_capacity - 1;
+    for (int i=chunk_slot(game, cx, cy); game->chunk_table[i] != NULL;
+         i = (i + 1) & mask) {
+        chunk = game->chunk_table[i];
+        if (chunk->x == cx && chunk->y == cy) {
+            game->last_chunk = chunk;
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Put a chunk into the first free slot for it in the hash table
+ */
+static void insert_chunk(struct EndlessGame *game, struct Chunk *chunk) {
+    int mask = game->chunk_capacity - 1;
+    int i = chunk_slot(game, chunk->x, chunk->y);
+    while (game->chunk_table[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    game->chunk_table[i] = chunk;
+}
+
+/*
+ * Double the size of the chunk hash table. Return 1 if successful, 0
+ * otherwise
+ */
+static int grow_chunk_table(struct EndlessGame *game) {
+    struct Chunk **old_table = game->chunk_table;
+    int old_capacity = game->chunk_capacity;
+
+    game->chunk_table = calloc(old_capacity * 2, sizeof(struct Chunk *));
+    if (game->chunk_table == NULL) {
+        print_error("Failed to allocate memory for the endless game");
+        game->chunk_table = old_table;
+        return 0;
+    }
+    game->chunk_capacity = old_capacity * 2;
+
+    for (int i=0; i<old_capacity; i++) {
+        if (old_table[i] != NULL) {
+            insert_chunk(game, old_table[i]);
+        }
+    }
+    free(old_table);
+    return 1;
+}
+
+/*
+ * Set every cell of a new chunk to unrevealed, holding its number of adjacent
+ * mines and whether it is a mine. The mines of the chunk and the ring of
+ * cells around it are hashed into a bordered byte plane first, so that each
+ * one is only hashed once
+ */
+static void fill_chunk(struct EndlessGame *game, struct Chunk *chunk) {
+    int stride = CHUNK_SIZE + 2;
+    unsigned char plane[(CHUNK_SIZE + 2) * (CHUNK_SIZE + 2)];
+
+    int x0 = chunk->x * CHUNK_SIZE;
+    int y0 = chunk->y * CHUNK_SIZE;
+    for (int y=0; y<stride; y++) {
+        for (int x=0; x<stride; x++) {
+            plane[x + y * stride] = endless_is_mine(game, x0 + x - 1,
+                                                    y0 + y - 1);
+        }
+    }
+
+    for (int y=0; y<CHUNK_SIZE; y++) {
+        const unsigned char *above = plane + y * stride + 1;
+        const unsigned char *row = above + stride;
+        const unsigned char *below = row + stride;
+        unsigned char *cells = chunk->cells + y * CHUNK_SIZE;
+        for (int x=0; x<CHUNK_SIZE; x++) {
+            cells[x] = above[x - 1] + above[x] + above[x + 1]
+                       + row[x - 1] + row[x + 1]
+                       + below[x - 1] + below[x] + below[x + 1]
+                       + row[x] * CELL_MINE;
+        }
+    }
+}
+
+/*
+ * Return the chunk at cx, cy, creating it if it does not exist yet. Return
+ * NULL if it could not be created
+ */
+static struct Chunk *get_chunk(struct EndlessGame *game, int cx, int cy) {
+    struct Chunk *chunk = find_chunk(game, cx, cy);
+    if (chunk != NULL) {
+        return chunk;
+    }
+
+    // Keep the table at most half full, so that probes stay short
+    if ((game->chunk_count + 1) * 2 > game->chunk_capacity &&
+        !grow_chunk_table(game)) {
+        return NULL;
+    }
+
+    chunk = malloc(sizeof(struct Chunk));
+    if (chunk == NULL) {
+        print_error("Failed to allocate memory for a chunk");
+        return NULL;
+    }
+    chunk->x = cx;
+    chunk->y = cy;
+    fill_chunk(game, chunk);
+
+    // Link the chunk to any neighbours that already exist, both ways
+    for (int i=0; i<9; i++) {
+        struct Chunk *neighbour = (i == 4 ? chunk :
+                                   find_chunk(game, cx + i % 3 - 1,
+                                              cy + i / 3 - 1));
+        chunk->neighbours[i] = neighbour;
+        if (neighbour != NULL) {
+            neighbour->neighbours[8 - i] = chunk;
+        }
+    }
+
+    insert_chunk(game, chunk);
+    game->chunk_count++;
+    game->last_chunk = chunk;
+    return chunk;
+}
+
+/*
+ * Return the chunk that the cell x, y is in, creating it if needed, and store
+ * the index of the cell in it in index_ptr. Return NULL if the chunk could not
+ * be created
+ */
+static struct Chunk *get_cell_chunk(struct EndlessGame *game, int x, int y,
+                                    int *index_ptr) {
+    int local_x = x & CHUNK_MASK;
+    int local_y = y & CHUNK_MASK;
+    *index_ptr = local_x + local_y * CHUNK_SIZE;
+
+    // The coordinates less their offset in the chunk divide exactly, so this
+    // rounds down for negative coordinates too
+    return get_chunk(game, (x - local_x) / CHUNK_SIZE,
+                     (y - local_y) / CHUNK_SIZE);
+}
+
+/*
+ * Return the number of mines adjacent to the cell x, y
+ */
+int endless_adjacent_mines(struct EndlessGame *game, int x, int y) {
+    int count = 0;
+    for (int dy=-1; dy<=1; dy++) {
+        for (int dx=-1; dx<=1; dx++) {
+            if (dx != 0 || dy != 0) {
+                count += endless_is_mine(game, x + dx, y + dy);
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ * Return the value of the cell x, y, as get_cell() does for a bounded board.
+ * This does not create the cell's chunk, since a cell in a chunk that does
+ * not exist has not been touched. Once a mine has exploded, every mine is
+ * shown
+ */
+int endless_get_cell(struct EndlessGame *game, int x, int y) {
+    if (game->mine_exploded && endless_is_mine(game, x, y)) {
+        return CELL_TYPE_MINE;
+    }
+
+    int local_x = x & CHUNK_MASK;
+    int local_y = y & CHUNK_MASK;
+    struct Chunk *chunk = find_chunk(game, (x - local_x) / CHUNK_SIZE,
+                                     (y - local_y) / CHUNK_SIZE);
+    if (chunk == NULL) {
+        return CELL_TYPE_UNKNOWN;
+    }
+    return decode_cell(chunk->cells[local_x + local_y * CHUNK_SIZE]);
+}
+
+/*
+ * Reveal a cell that does not contain a mine, and push it onto the reveal
+ * stack if it has no adjacent mines. Return 1 if successful, 0 if the stack
+ * could not grow
+ */
+static int uncover_cell(struct EndlessGame *game, struct Chunk *chunk,
+                        int index, int *stack_size) {
+    chunk->cells[index] |= CELL_REVEALED;
+    game->cells_revealed++;
+
+    if ((chunk->cells[index] & CELL_COUNT_MASK) != 0) {
+        return 1;
+    }
+
+    if (*stack_size == game->reveal_stack_capacity) {
+        int capacity = game->reveal_stack_capacity * 2;
+        struct ChunkCell *stack = realloc(game->reveal_stack,
+                                          sizeof(struct ChunkCell) * capacity);
+        if (stack == NULL) {
+            print_error("Failed to allocate memory for the reveal stack");
+            return 0;
+        }
+        game->reveal_stack = stack;
+        game->reveal_stack_capacity = capacity;
+    }
+
+    game->reveal_stack[*stack_size].chunk = chunk;
+    game->reveal_stack[*stack_size].index = index;
+    (*stack_size)++;
+    return 1;
+}
+
+/*
+ * Uncover the neighbours of a cell on the edge of its chunk, some of which are
+ * in the neighbouring chunks. Those chunks are created if they do not exist
+ * yet. Return 1 if successful, 0 otherwise
+ */
+static int uncover_edge_neighbours(struct EndlessGame *game,
+                                   struct Chunk *chunk, int index,
+                                   int *stack_size) {
+    int x = index % CHUNK_SIZE;
+    int y = index / CHUNK_SIZE;
+
+    for (int dy=-1; dy<=1; dy++) {
+        for (int dx=-1; dx<=1; dx++) {
+            int nx = x + dx;
+            int ny = y + dy;
+
+            // Which chunk the neighbour is in, relative to this one
+            int cx = (nx < 0 ? 0 : (nx < CHUNK_SIZE ? 1 : 2));
+            int cy = (ny < 0 ? 0 : (ny < CHUNK_SIZE ? 1 : 2));
+            struct Chunk *target = chunk->neighbours[cx + cy * 3];
+            if (target == NULL) {
+                target = get_chunk(game, chunk->x + cx - 1, chunk->y + cy - 1);
+                if (target == NULL) {
+                    return 0;
+                }
+            }
+
+            int target_index = (nx & CHUNK_MASK) + (ny & CHUNK_MASK) *
+                                                   CHUNK_SIZE;
+            if (!(target->cells[target_index] &
+                  (CELL_REVEALED | CELL_FLAGGED)) &&
+                !uncover_cell(game, target, target_index, stack_size)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Reveal a cell, and cascade through the cells with no adjacent mines as
+ * reveal_cell() does. If the cell is a mine, set the mine_exploded flag. The
+ * cascade walks the cells inside a chunk with fixed offsets, and only cells on
+ * the edge of a chunk look at the chunks around it. Return 1 if successful, 0
+ * if the memory for the cascade could not be allocated
+ */
+int endless_reveal_cell(struct EndlessGame *game, int x, int y) {
+    int index;
+    struct Chunk *chunk = get_cell_chunk(game, x, y, &index);
+    if (chunk == NULL) {
+        return 0;
+    }
+
+    if (chunk->cells[index] & (CELL_REVEALED | CELL_FLAGGED)) {
+        return 1;
+    }
+
+    if (chunk->cells[index] & CELL_MINE) {
+        chunk->cells[index] |= CELL_REVEALED;
+        game->mine_exploded = 1;
+        return 1;
+    }
+
+    int stack_size = 0;
+    if (!uncover_cell(game, chunk, index, &stack_size)) {
+        return 0;
+    }
+
+    while (stack_size > 0) {
+        struct ChunkCell current = game->reveal_stack[--stack_size];
+        int cx = current.index % CHUNK_SIZE;
+        int cy = current.index / CHUNK_SIZE;
+
+        if (cx == 0 || cx == CHUNK_SIZE - 1 || cy == 0 || cy == CHUNK_SIZE - 1) {
+            if (!uncover_edge_neighbours(game, current.chunk, current.index,
+                                         &stack_size)) {
+                return 0;
+            }
+            continue;
+        }
+
+        // None of the neighbours can be a mine, since the cell has no
+        // adjacent mines
+        unsigned char *cells = current.chunk->cells;
+        for (int i=0; i<8; i++) {
+            int neighbour = current.index + neighbour_offsets[i];
+            if (!(cells[neighbour] & (CELL_REVEALED | CELL_FLAGGED)) &&
+                !uncover_cell(game, current.chunk, neighbour, &stack_size)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Reveal all unknown cells adjacent to the cell x, y. Return 1 if successful,
+ * 0 otherwise
+ */
+int endless_reveal_neighbouring_cells(struct EndlessGame *game, int x, int y) {
+    for (int dy=-1; dy<=1; dy++) {
+        for (int dx=-1; dx<=1; dx++) {
+            if (endless_get_cell(game, x + dx, y + dy) == CELL_TYPE_UNKNOWN &&
+                !endless_reveal_cell(game, x + dx, y + dy)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * Set the cell x, y to a flag if it is currently unknown, and set it to
+ * unknown if it is currently a flag. Return 1 if successful, 0 if its chunk
+ * could not be created
+ */
+int endless_toggle_flag(struct EndlessGame *game, int x, int y) {
+    int index;
+    struct Chunk *chunk = get_cell_chunk(game, x, y, &index);
+    if (chunk == NULL) {
+        return 0;
+    }
+
+    if (!(chunk->cells[index] & CELL_REVEALED)) {
+        chunk->cells[index] ^= CELL_FLAGGED;
+        game->flags_placed += (chunk->cells[index] & CELL_FLAGGED ? 1 : -1);
+    }
+    return 1;
+}
+
+/*
+ * Respond to a click on the cell x, y, as click_cell() does for a board with
+ * edges. A left click (button 1) reveals the cell if it is unknown, or its
+ * neighbours if it is already revealed, and a right click (button 2) toggles
+ * a flag. Return 1 if successful, 0 if a chunk could not be created
+ */
+int endless_click_cell(struct EndlessGame *game, int x, int y, int button) {
+    if (button == 1) {
+        int cell = endless_get_cell(game, x, y);
+        if (cell == CELL_TYPE_UNKNOWN) {
+            return endless_reveal_cell(game, x, y);
+        }
+        if (cell != CELL_TYPE_FLAG) {
+            return endless_reveal_neighbouring_cells(game, x, y);
+        }
+    }
+    else if (button == 2) {
+        return endless_toggle_flag(game, x, y);
+    }
+    return 1;
+}
+
+/*
+ * Return the number of bytes allocated for an endless board
+ */
+size_t endless_memory_usage(struct EndlessGame *game) {
+    return sizeof(struct Chunk) * game->chunk_count +
+           sizeof(struct Chunk *) * game->chunk_capacity +
+           sizeof(struct ChunkCell) * game->reveal_stack_capacity;
+}
@@ -0,0 +1,89 @@
+#ifndef ENDLESS_H
+#define ENDLESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The width/height of each chunk of an endless board in cells. This must be a
+// power of 2
+#define CHUNK_SIZE 64
+#define CHUNK_CELLS (CHUNK_SIZE * CHUNK_SIZE)
+
+// The range of mine densities allowed. Below the minimum, the areas with no
+// adjacent mines join up into one that never ends, so the first reveal would
+// never finish
+#define ENDLESS_MIN_DENSITY 0.15
+#define ENDLESS_MAX_DENSITY 0.9
+
+/*
+ * A square block of cells of an endless board. Chunks are only created when
+ * one of their cells is revealed or flagged, so the memory used grows with the
+ * area explored rather than the size of the board
+ */
+struct Chunk {
+    // The position of the chunk, in chunks. Cell x, y is in chunk
+    // floor(x / CHUNK_SIZE), floor(y / CHUNK_SIZE)
+    int x;
+    int y;
+
+    // One byte per cell, row by row, made up of the CELL_ bits from
+    // minesweeper.h. The counts include mines in the neighbouring chunks
+    unsigned char cells[CHUNK_CELLS];
+
+    // The chunks around this one, indexed by (dx + 1) + (dy + 1) * 3, or NULL
+    // if they have not been created yet. Index 4 is the chunk itself. These
+    // let the reveal cascade cross into a neighbouring chunk without a lookup
+    struct Chunk *neighbours[9];
+};
+
+/*
+ * A cell in a chunk, as held on the reveal stack
+ */
+struct ChunkCell {
+    struct Chunk *chunk;
+    int index;  // x + y * CHUNK_SIZE within the chunk
+};
+
+/*
+ * A board with no edges. Whether a cell is a mine is a hash of the seed and
+ * its coordinates, so it does not need storing, and the mines of a part of
+ * the board are only worked out when a chunk there is created. The cells next
+ * to 0, 0 never have mines, so revealing 0, 0 first always opens an area
+ */
+struct EndlessGame {
+    uint64_t seed;
+
+    // A cell is a mine if the top 32 bits of its hash are below this
+    uint64_t mine_threshold;
+    double density;
+
+    // Hash table of the chunks that have been created, by position, using
+    // linear probing. The capacity is a power of 2
+    struct Chunk **chunk_table;
+    int chunk_capacity;
+    int chunk_count;
+
+    // The chunk found by the last lookup, since lookups tend to be repeated
+    struct Chunk *last_chunk;
+
+    // Work stack for the reveal cascade. This grows as needed
+    struct ChunkCell *reveal_stack;
+    int reveal_stack_capacity;
+
+    long cells_revealed;
+    int flags_placed;
+    int mine_exploded;
+};
+
+int init_endless_game(struct EndlessGame *game, uint64_t seed, double density);
+void free_endless_game(struct EndlessGame *game);
+int endless_is_mine(struct EndlessGame *game, int x, int y);
+int endless_adjacent_mines(struct EndlessGame *game, int x, int y);
+int endless_get_cell(struct EndlessGame *game, int x, int y);
+int endless_reveal_cell(struct EndlessGame *game, int x, int y);
+int endless_reveal_neighbouring_cells(struct EndlessGame *game, int x, int y);
+int endless_toggle_flag(struct EndlessGame *game, int x, int y);
+int endless_click_cell(struct EndlessGame *game, int x, int y, int button);
+size_t endless_memory_usage(struct EndlessGame *game);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "minesweeper.h"
+#include "generator.h"
+#include "solver.h"
+#include "threadpool.h"
+#include "rng.h"
+#include "error.h"
+
+#define NOT_FOUND -1
+
+/*
+ * A board is accepted if the solver, starting by revealing the start cell,
+ * can uncover every safe cell by deduction alone. The candidates for a seed
+ * are numbered 0, 1, 2, ... and each one's mines are placed from a seed
+ * derived from the seed and that number. The threads claim candidates in
+ * order, and stop once every candidate before the best one found so far has
+ * been tested, so the chosen board is always the first one that passes,
+ * however many threads there are and however they are scheduled
+ */
+
+/*
+ * Return the current time in seconds from a monotonic clock
+ */
+static double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Return the seed that the mines of a candidate board are placed from
+ */
+static uint64_t candidate_seed(uint64_t seed, long attempt) {
+    uint64_t state = seed + attempt * 0x9e3779b97f4a7c15ULL;
+    return splitmix64(&state);
+}
+
+/*
+ * Allocate scratch space for generating boards of up to cell_count cells. If
+ * pool is not NULL then candidates are tested on all of its threads. Return 1
+ * if successful, 0 otherwise
+ */
+int init_generator(struct Generator *generator, int cell_count,
+                   struct ThreadPool *pool) {
+    memset(generator, 0, sizeof(*generator));
+    generator->capacity = cell_count;
+    generator->pool = pool;
+    generator->worker_count = (pool != NULL ? pool->thread_count : 1);
+    generator->workers = calloc(generator->worker_count,
+                                sizeof(struct GeneratorWorker));
+    if (generator->workers == NULL) {
+        print_error("Failed to allocate memory for the generator");
+        return 0;
+    }
+
+    for (int i=0; i<generator->worker_count; i++) {
+        init_arena(&(generator->workers[i].arena));
+        if (!init_solver(&(generator->workers[i].solver), cell_count)) {
+            free_generator(generator);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Free the scratch space allocated by init_generator()
+ */
+void free_generator(struct Generator *generator) {
+    for (int i=0; generator->workers != NULL && i<generator->worker_count; i++) {
+        free_arena(&(generator->workers[i].arena));
+        free_solver(&(generator->workers[i].solver));
+    }
+    free(generator->workers);
+    memset(generator, 0, sizeof(*generator));
+}
+
+/*
+ * Make sure a worker's board has the dimensions and mine count being
+ * generated. Return 1 if successful, 0 otherwise
+ */
+static int prepare_worker(struct Generator *generator,
+                          struct GeneratorWorker *worker) {
+    struct Game *game = &(worker->game);
+    if (worker->game_initialised && game->width == generator->width &&
+        game->height == generator->height &&
+        game->mine_count == generator->mine_count) {
+        return 1;
+    }
+
+    // This replaces the last board in the arena
+    worker->game_initialised = 0;
+    if (!init_game_in_arena(game, &(worker->arena), generator->width,
+                            generator->height, generator->mine_count,
+                            generator->seed)) {
+        return 0;
+    }
+    worker->game_initialised = 1;
+    return 1;
+}
+
+/*
+ * Return 1 if a candidate board can be solved without guessing, 0 otherwise
+ */
+static int test_candidate(struct Generator *generator,
+                          struct GeneratorWorker *worker, long attempt) {
+    struct Game *game = &(worker->game);
+    if (!reset_game_with_opening(game, candidate_seed(generator->seed, attempt),
+                                 generator->start_x, generator->start_y)) {
+        return 0;
+    }
+
+    reveal_cell(game, generator->start_x, generator->start_y);
+
+    struct SolverResult result;
+    memset(&result, 0, sizeof(result));
+    solver_run(&(worker->solver), game, &result);
+    return won_game(game);
+}
+
+/*
+ * Lower found_attempt to attempt if it is not already lower
+ */
+static void record_found(struct Generator *generator, long attempt) {
+    long found = __atomic_load_n(&(generator->found_attempt), __ATOMIC_RELAXED);
+    while ((found == NOT_FOUND || attempt < found) &&
+           !__atomic_compare_exchange_n(&(generator->found_attempt), &found,
+                                        attempt, 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+/*
+ * Thread pool task: test candidates in order until one before every
+ * unclaimed candidate has passed, or time runs out
+ */
+static void search_task(void *context, int index, int thread) {
+    struct Generator *generator = context;
+    struct GeneratorWorker *worker = &(generator->workers[index]);
+    if (!prepare_worker(generator, worker)) {
+        return;
+    }
+
+    while (1) {
+        long attempt = __atomic_fetch_add(&(generator->next_attempt), 1,
+                                          __ATOMIC_RELAXED);
+        long found = __atomic_load_n(&(generator->found_attempt),
+                                     __ATOMIC_RELAXED);
+        if (found != NOT_FOUND && attempt > found) {
+            break;
+        }
+        if (get_time() > generator->deadline) {
+            break;
+        }
+
+        worker->attempts++;
+        if (test_candidate(generator, worker, attempt)) {
+            record_found(generator, attempt);
+        }
+    }
+}
+
+/*
+ * Place the mines of game, which must already be initialised with the size
+ * and mine count wanted (by init_game() or init_game_in_arena()), so that the
+ * board can be solved without guessing by revealing (start_x, start_y) first,
+ * which is always safe and opens up an area. The same arguments always give
+ * the same board, unless time_budget seconds run out first. If no board has
+ * been found by then, the first candidate is used, which is still safe to
+ * start at but may need guesses. result->no_guess says which happened. The
+ * caller should reveal the start cell. Return 1 if successful, 0 otherwise
+ */
+int generate_no_guess_game(struct Generator *generator, struct Game *game,
+                           uint64_t seed, int start_x, int start_y,
+                           double time_budget, struct GeneratorResult *result) {
+    double start = get_time();
+    memset(result, 0, sizeof(*result));
+
+    if (game->width * game->height > generator->capacity) {
+        print_error("Generator is too small for the board");
+        return 0;
+    }
+
+    generator->width = game->width;
+    generator->height = game->height;
+    generator->mine_count = game->mine_count;
+    generator->seed = seed;
+    generator->start_x = start_x;
+    generator->start_y = start_y;
+    generator->deadline = start + time_budget;
+    generator->next_attempt = 0;
+    generator->found_attempt = NOT_FOUND;
+    for (int i=0; i<generator->worker_count; i++) {
+        generator->workers[i].attempts = 0;
+    }
+
+    if (generator->pool != NULL) {
+        thread_pool_run(generator->pool, generator->worker_count, search_task,
+                        generator);
+    }
+    else {
+        search_task(generator, 0, 0);
+    }
+
+    for (int i=0; i<generator->worker_count; i++) {
+        result->attempts += generator->workers[i].attempts;
+    }
+
+    // If time ran out after a board was found, earlier candidates may not have
+    // been tested, so the board may differ between runs, but it still needs
+    // no guesses
+    if (generator->found_attempt != NOT_FOUND) {
+        result->no_guess = 1;
+        result->attempt = generator->found_attempt;
+    }
+    else {
+        result->no_guess = 0;
+        result->attempt = 0;
+    }
+
+    int ok = reset_game_with_opening(game,
+                                     candidate_seed(seed, result->attempt),
+                                     start_x, start_y);
+    result->elapsed = get_time() - start;
+    return ok;
+}
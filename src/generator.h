@@ -0,0 +1,64 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stdint.h>
+
+#include "minesweeper.h"
+#include "solver.h"
+#include "threadpool.h"
+
+/*
+ * Scratch space for one thread testing candidate boards
+ */
+struct GeneratorWorker {
+    // The board candidates are tested on. Its memory is in arena, so changing
+    // the size of board being generated only allocates when it is bigger than
+    // any before
+    struct Game game;
+    int game_initialised;
+    struct Arena arena;
+    struct Solver solver;
+    long attempts;
+};
+
+/*
+ * Generates boards that can be solved from the first click without guessing.
+ * Candidate boards are tested by the solver on every thread of the pool at
+ * once. This is sized for the largest board it will be used on
+ */
+struct Generator {
+    int capacity;  // The number of cells the scratch space has room for
+    struct ThreadPool *pool;
+    int worker_count;
+    struct GeneratorWorker *workers;
+
+    // The state of the current search, shared between the threads
+    int width;
+    int height;
+    int mine_count;
+    uint64_t seed;
+    int start_x;
+    int start_y;
+    double deadline;
+    long next_attempt;
+    long found_attempt;
+};
+
+/*
+ * The outcome of generate_no_guess_game()
+ */
+struct GeneratorResult {
+    int no_guess;   // 1 if the board was verified to need no guesses
+    long attempt;   // The index of the candidate that was used
+    long attempts;  // The number of candidates tested, across all threads
+    double elapsed;
+};
+
+int init_generator(struct Generator *generator, int cell_count,
+                   struct ThreadPool *pool);
+void free_generator(struct Generator *generator);
+int generate_no_guess_game(struct Generator *generator, struct Game *game,
+                           uint64_t seed, int start_x, int start_y,
+                           double time_budget, struct GeneratorResult *result);
+
+#endif
@@ -1,18 +1,21 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_primitives.h>
 #include <allegro5/allegro_font.h>
 #include <allegro5/allegro_image.h>
 #include <allegro5/allegro_ttf.h>
+#include <allegro5/allegro_memfile.h>
 
 #include "minesweeper.h"
+#include "endless.h"
 #include "graphics.h"
+#include "assets.h"
 #include "error.h"
 
-#define GRAPHICS_FPS 30
-
 #define FONT_NAME "DejaVuSans.ttf"
 #define TITLE_FONT_SIZE 20
 #define BUTTON_FONT_SIZE 30
@@ -27,8 +30,28 @@
 // (100% = Circle)
 #define GRID_CELL_RADIUS 0.25
 
+// The number of different cell appearances: mine, unknown, no mines, flag and
+// the digits 1-8
+#define SPRITE_COUNT 12
+
+// The smallest a cell (including its padding) can be zoomed out to in px,
+// unless the whole board fits at a smaller size. This bounds how many cells
+// are ever on screen at once
+#define MIN_CELL_SIZE 10
+
+// The largest a cell (including its padding) can be zoomed in to in px,
+// unless the whole board already fits at a larger size
+#define MAX_CELL_SIZE 120
+
+// The size (including padding) boards that do not fit on the display start
+// at in px
+#define START_CELL_SIZE 24
+
+// How much each step of zoom_camera() scales the cells by
+#define ZOOM_FACTOR 1.25
+
 // The number of images used in the application
-#define IMAGE_COUNT 2
+#define IMAGE_COUNT 3
 
 // A struct to store and retreive ALLEGRO_BITMAPs by filename
 struct BitmapContainer {
@@ -37,6 +60,24 @@ struct BitmapContainer {
     void *bitmaps[IMAGE_COUNT];
 };
 
+// The most fonts that can be loaded at once
+#define MAX_FONTS 16
+
+// A loaded font, and the number of users that have acquired it
+struct CachedFont {
+    char name[20];
+    int size;
+    int refcount;
+    ALLEGRO_FONT *font;
+};
+
+// A struct to share loaded fonts by file and size, so that each is only
+// loaded once
+struct FontCache {
+    int count;
+    struct CachedFont fonts[MAX_FONTS];
+};
+
 // Colours
 ALLEGRO_COLOR line_colour;
 ALLEGRO_COLOR mine_colour;
@@ -50,22 +91,181 @@ ALLEGRO_COLOR button_text_colour;
 ALLEGRO_COLOR label_colour;
 
 ALLEGRO_FONT *cell_font;
+int cell_font_size;
+
+// Every cell appearance, rendered at the current cell size. See
+// build_cell_atlas()
+ALLEGRO_BITMAP *cell_atlas;
+int cell_atlas_size;
+
+// The blender in use before begin_cell_batch()
+ALLEGRO_STATE cell_batch_state;
+
+struct RenderStats render_stats;
 ALLEGRO_FONT *title_font;
 ALLEGRO_FONT *button_font;
 
-// Paths to game assets
-char assets_path[200];
-char font_path[200];
-
 struct BitmapContainer bitmap_container;
+struct FontCache font_cache;
+
+// The layout of the grid for the current game
+struct GridLayout grid_layout;
+
+// The display, and an offscreen bitmap the size of it for each layer. Each
+// layer keeps its contents between frames, and presenting a frame only
+// composites the visible layers (see composite_layers())
+ALLEGRO_DISPLAY *layer_display;
+ALLEGRO_BITMAP *layers[LAYER_COUNT];
+int layer_visible[LAYER_COUNT];
+enum Layer current_layer;
+
+/*
+ * Open an asset (by file name) that has been compiled into the executable as
+ * an in-memory file. Exit if there is no such asset
+ */
+ALLEGRO_FILE *open_asset(const char *name) {
+    for (int i=0; i<asset_count; i++) {
+        if (strcmp(assets[i].name, name) == 0) {
+            return al_open_memfile((void *) assets[i].data, assets[i].size, "r");
+        }
+    }
+
+    print_error("No asset called %s", name);
+    exit_app(EXIT_FAILURE);
+    return NULL;
+}
+
+/*
+ * Return the font asset called name in the specified size, loading it if it
+ * is not in the font cache. Each call must be matched by a call to
+ * release_font() once the font is no longer needed. Return NULL if the font
+ * cannot be loaded
+ */
+ALLEGRO_FONT *acquire_font(const char *name, int size) {
+    for (int i=0; i<font_cache.count; i++) {
+        struct CachedFont *cached = &(font_cache.fonts[i]);
+        if (cached->size == size && strcmp(cached->name, name) == 0) {
+            cached->refcount++;
+            return cached->font;
+        }
+    }
+
+    if (font_cache.count == MAX_FONTS) {
+        print_error("Too many fonts loaded");
+        return NULL;
+    }
+
+    // The font reads glyphs from the file as they are needed, and closes it
+    // when it is destroyed
+    ALLEGRO_FILE *file = open_asset(name);
+    ALLEGRO_FONT *font = al_load_ttf_font_f(file, name, size, 0);
+    if (font == NULL) {
+        print_error("Failed to load %s", name);
+        al_fclose(file);
+        return NULL;
+    }
+
+    struct CachedFont *cached = &(font_cache.fonts[font_cache.count++]);
+    strcpy(cached->name, name);
+    cached->size = size;
+    cached->refcount = 1;
+    cached->font = font;
+    return font;
+}
+
+/*
+ * Give up a font returned by acquire_font(), destroying it if nothing else is
+ * using it
+ */
+void release_font(ALLEGRO_FONT *font) {
+    for (int i=0; i<font_cache.count; i++) {
+        struct CachedFont *cached = &(font_cache.fonts[i]);
+        if (cached->font != font) {
+            continue;
+        }
+
+        cached->refcount--;
+        if (cached->refcount == 0) {
+            al_destroy_font(cached->font);
+            font_cache.fonts[i] = font_cache.fonts[--font_cache.count];
+        }
+        return;
+    }
+}
+
+/*
+ * Destroy every font in the font cache. This is called at exit, before
+ * allegro shuts down
+ */
+void free_fonts() {
+    for (int i=0; i<font_cache.count; i++) {
+        al_destroy_font(font_cache.fonts[i].font);
+    }
+    font_cache.count = 0;
+}
+
+/*
+ * Create a transparent offscreen bitmap the size of the display for each
+ * layer. Only the background layer is visible to begin with. Return 1 if
+ * successful, 0 otherwise
+ */
+int init_layers(ALLEGRO_DISPLAY *display) {
+    layer_display = display;
+    for (int i=0; i<LAYER_COUNT; i++) {
+        layers[i] = al_create_bitmap(al_get_display_width(display),
+                                     al_get_display_height(display));
+        if (layers[i] == NULL) {
+            print_error("Failed to create layer bitmap");
+            return 0;
+        }
+        layer_visible[i] = (i == LAYER_BACKGROUND);
+        clear_layer(i);
+    }
+
+    select_layer(LAYER_BACKGROUND);
+    return 1;
+}
+
+/*
+ * Make the specified layer the target for all drawing until another layer is
+ * selected
+ */
+void select_layer(enum Layer layer) {
+    current_layer = layer;
+    al_set_target_bitmap(layers[layer]);
+}
+
+/*
+ * Clear the specified layer to transparent, and select it
+ */
+void clear_layer(enum Layer layer) {
+    select_layer(layer);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+}
+
+/*
+ * Show or hide a layer when frames are composited. Its contents are kept
+ * either way
+ */
+void set_layer_visible(enum Layer layer, int visible) {
+    layer_visible[layer] = visible;
+}
 
 /*
- * Return the full path to a file in the assets directory
+ * Draw the visible layers onto the backbuffer in order, ready for the frame
+ * to be flipped. The selected layer stays the target for drawing afterwards
  */
-const char *get_asset_path(const char *filename) {
-    char *path = malloc(strlen(assets_path) + strlen(filename) + 1);
-    sprintf(path, "%s%s", assets_path, filename);
-    return path;
+void composite_layers() {
+    al_set_target_backbuffer(layer_display);
+    for (int i=0; i<LAYER_COUNT; i++) {
+        if (layer_visible[i]) {
+            al_draw_bitmap(layers[i], 0, 0, 0);
+            render_stats.layer_blits++;
+        }
+    }
+    render_stats.composites++;
+
+    select_layer(current_layer);
 }
 
 /*
@@ -73,10 +273,11 @@ const char *get_asset_path(const char *filename) {
  * queue. Return 1 if successful, 0 otherwise
  */
 int init_allegro(int width, int height, ALLEGRO_DISPLAY **display,
-                 ALLEGRO_EVENT_QUEUE **event_queue, ALLEGRO_TIMER **timer) {
+                 ALLEGRO_EVENT_QUEUE **event_queue) {
 
-    // Initialise the bitmap collection
+    // Initialise the bitmap collection and font cache
     bitmap_container.count = 0;
+    font_cache.count = 0;
 
     if (!al_init()) {
         print_error("Failed to initialise allegro");
@@ -98,25 +299,33 @@ int init_allegro(int width, int height, ALLEGRO_DISPLAY **display,
         return 0;
     }
 
+    // Registered after al_init(), so this runs before allegro's own clean up
+    atexit(free_fonts);
+
     if (!al_install_mouse()) {
         print_error("Failed to install mouse");
         return 0;
     }
+    if (!al_install_keyboard()) {
+        print_error("Failed to install keyboard");
+        return 0;
+    }
 
-    // Create the display
+    // Create the display. Frames are only presented when something has
+    // changed, and vsync stops al_flip_display() from tearing them
+    // Expose events say when the window needs to be presented again, e.g.
+    // after being uncovered
+    al_set_new_display_flags(ALLEGRO_GENERATE_EXPOSE_EVENTS);
+    al_set_new_display_option(ALLEGRO_VSYNC, 1, ALLEGRO_SUGGEST);
     *display = al_create_display(width, height);
     if (!(*display)) {
         print_error("Failed to create display");
         return 0;
     }
 
-    // Create and start the timer
-    *timer = al_create_timer(1.0 / GRAPHICS_FPS);
-    if (!(*timer)) {
-        print_error("Failed to create timer");
+    if (!init_layers(*display)) {
         return 0;
     }
-    al_start_timer(*timer);
 
     // Create and register the event queue
     *event_queue = al_create_event_queue();
@@ -126,7 +335,7 @@ int init_allegro(int width, int height, ALLEGRO_DISPLAY **display,
     }
     al_register_event_source(*event_queue, al_get_display_event_source(*display));
     al_register_event_source(*event_queue, al_get_mouse_event_source());
-    al_register_event_source(*event_queue, al_get_timer_event_source(*timer));
+    al_register_event_source(*event_queue, al_get_keyboard_event_source());
 
     // Create the colours
     line_colour =              al_map_rgb(10, 10, 10);
@@ -147,21 +356,11 @@ int init_allegro(int width, int height, ALLEGRO_DISPLAY **display,
     button_text_colour =       al_map_rgb(0, 0, 0);
     label_colour =             al_map_rgb(200, 200, 200);
 
-    // Set assets path
-    ALLEGRO_PATH *assets_path_al = al_get_standard_path(ALLEGRO_RESOURCES_PATH);
-    ALLEGRO_PATH *assets_path_relative = al_create_path_for_directory("assets");
-    al_join_paths(assets_path_al, assets_path_relative);
-    strcpy(assets_path, al_path_cstr(assets_path_al, ALLEGRO_NATIVE_PATH_SEP));
-    al_destroy_path(assets_path_al);
-    al_destroy_path(assets_path_relative);
-
-    // Set font path and load fonts
-    strcpy(font_path, get_asset_path(FONT_NAME));
-    title_font = al_load_ttf_font(font_path, TITLE_FONT_SIZE, 0);
-    button_font = al_load_ttf_font(font_path, BUTTON_FONT_SIZE, 0);
+    // Load fonts
+    title_font = acquire_font(FONT_NAME, TITLE_FONT_SIZE);
+    button_font = acquire_font(FONT_NAME, BUTTON_FONT_SIZE);
 
     if (title_font == NULL || button_font == NULL) {
-        print_error("Failed to load %s", font_path);
         exit_app(EXIT_FAILURE);
     }
 
@@ -179,12 +378,14 @@ ALLEGRO_BITMAP *get_bitmap(char *name) {
             return bitmap_container.bitmaps[i];
         }
     }
-    // If reached here then the bitmap has not been found, so create it
-    const char *path = get_asset_path(name);
-    ALLEGRO_BITMAP *bmp = al_load_bitmap(path);
+    // If reached here then the bitmap has not been found, so create it. The
+    // file extension tells allegro what format it is in
+    ALLEGRO_FILE *file = open_asset(name);
+    ALLEGRO_BITMAP *bmp = al_load_bitmap_f(file, strrchr(name, '.'));
+    al_fclose(file);
 
     if (bmp == NULL) {
-        print_error("Failed to load %s", path);
+        print_error("Failed to load %s", name);
         exit_app(EXIT_FAILURE);
     }
 
@@ -196,6 +397,237 @@ ALLEGRO_BITMAP *get_bitmap(char *name) {
     return bmp;
 }
 
+/*
+ * Load every image asset into the bitmap collection now, rather than the
+ * first time each one is drawn
+ */
+void preload_images() {
+    for (int i=0; i<asset_count; i++) {
+        const char *extension = strrchr(assets[i].name, '.');
+        if (extension != NULL && strcmp(extension, ".png") == 0) {
+            get_bitmap((char *) assets[i].name);
+        }
+    }
+}
+
+/*
+ * Set the size of the cells, including padding, and make sure the cell font
+ * and atlas match it
+ */
+void set_cell_size(float total_size) {
+    // CELL_PADDING is a percentage of total cell size
+    grid_layout.cell_padding = total_size * CELL_PADDING;
+    grid_layout.cell_size = total_size - 2 * grid_layout.cell_padding;
+
+    // The numbers in the cells are as tall as the cells
+    int font_size = grid_layout.cell_size;
+    if (cell_font == NULL || font_size != cell_font_size) {
+        if (cell_font != NULL) {
+            release_font(cell_font);
+        }
+        cell_font = acquire_font(FONT_NAME, font_size);
+        cell_font_size = font_size;
+        if (cell_font == NULL) {
+            exit_app(EXIT_FAILURE);
+        }
+
+        build_cell_atlas(font_size);
+    }
+}
+
+/*
+ * Return the size of a cell including its padding in px
+ */
+float get_total_cell_size() {
+    return grid_layout.cell_size + 2 * grid_layout.cell_padding;
+}
+
+/*
+ * Keep the grid in view along one axis. The grid is centred if it fits in
+ * the view, otherwise it is kept covering the whole view. Return the new
+ * offset
+ */
+float clamp_grid_offset(float offset, float grid_size, int view_start,
+                        int view_end) {
+    if (grid_size <= view_end - view_start) {
+        return view_start + (view_end - view_start - grid_size) / 2;
+    }
+    if (offset > view_start) {
+        return view_start;
+    }
+    if (offset + grid_size < view_end) {
+        return view_end - grid_size;
+    }
+    return offset;
+}
+
+/*
+ * Set the offsets of the grid to (x_offset, y_offset), moved as little as
+ * needed to keep it in view. game is NULL for an endless board, which has no
+ * edges to keep in view
+ */
+void set_grid_offset(struct Game *game, float x_offset, float y_offset) {
+    if (game == NULL) {
+        grid_layout.x_padding = x_offset;
+        grid_layout.y_padding = y_offset;
+        return;
+    }
+
+    float total_size = get_total_cell_size();
+    grid_layout.x_padding = clamp_grid_offset(x_offset,
+                                              total_size * game->width,
+                                              grid_layout.view_x1,
+                                              grid_layout.view_x2);
+    grid_layout.y_padding = clamp_grid_offset(y_offset,
+                                              total_size * game->height,
+                                              grid_layout.view_y1,
+                                              grid_layout.view_y2);
+}
+
+/*
+ * Work out the size of the cells and the offsets of the grid so that the grid
+ * for the provided game fits in the display, centred, with at least
+ * GRID_PADDING px around it. Boards too big for the cells to be readable at
+ * that size start zoomed in on their centre instead, and the camera can then
+ * be moved with pan_camera() and zoom_camera()
+ */
+void set_grid_layout(struct Game *game, int display_width, int display_height) {
+    grid_layout.view_x1 = GRID_PADDING;
+    grid_layout.view_y1 = GRID_PADDING;
+    grid_layout.view_x2 = display_width - GRID_PADDING;
+    grid_layout.view_y2 = display_height - GRID_PADDING;
+
+    // Calculate the largest cell size in px that fits the whole grid
+    float x = (float) (display_width - 2 * GRID_PADDING) / game->width;
+    float y = (float) (display_height - 2 * GRID_PADDING) / game->height;
+    grid_layout.fit_size = (x < y ? x : y);
+
+    set_cell_size(grid_layout.fit_size >= MIN_CELL_SIZE ?
+                  grid_layout.fit_size : START_CELL_SIZE);
+
+    // Centre the grid. If it is bigger than the view this shows its centre
+    float total_size = get_total_cell_size();
+    set_grid_offset(game, (display_width - total_size * game->width) / 2,
+                    (display_height - total_size * game->height) / 2);
+}
+
+/*
+ * Lay out the grid for an endless board, which never fits in the display, at
+ * the size boards that do not fit start at, with the centre of cell 0, 0 in
+ * the middle of the view. The camera is moved with pan_camera() and
+ * zoom_camera() as for other boards, passing NULL for the game
+ */
+void set_endless_layout(int display_width, int display_height) {
+    grid_layout.view_x1 = GRID_PADDING;
+    grid_layout.view_y1 = GRID_PADDING;
+    grid_layout.view_x2 = display_width - GRID_PADDING;
+    grid_layout.view_y2 = display_height - GRID_PADDING;
+
+    // Zooming is only limited by MIN_CELL_SIZE and MAX_CELL_SIZE
+    grid_layout.fit_size = 0;
+    set_cell_size(START_CELL_SIZE);
+    centre_camera(NULL, 0.5, 0.5);
+}
+
+/*
+ * Move the grid by (dx, dy) px, as far as it can go while staying in view.
+ * Return 1 if it moved, 0 otherwise
+ */
+int pan_camera(struct Game *game, float dx, float dy) {
+    float x_offset = grid_layout.x_padding;
+    float y_offset = grid_layout.y_padding;
+    set_grid_offset(game, x_offset + dx, y_offset + dy);
+
+    return (grid_layout.x_padding != x_offset ||
+            grid_layout.y_padding != y_offset);
+}
+
+/*
+ * Zoom in (steps > 0) or out (steps < 0) by ZOOM_FACTOR per step, keeping
+ * the point (x, y) of the display over the same part of the grid. Return 1
+ * if the zoom changed, 0 if it was already at its limit
+ */
+int zoom_camera(struct Game *game, int steps, int x, int y) {
+    float min_size = (grid_layout.fit_size < MIN_CELL_SIZE ?
+                      MIN_CELL_SIZE : grid_layout.fit_size);
+    float max_size = (grid_layout.fit_size > MAX_CELL_SIZE ?
+                      grid_layout.fit_size : MAX_CELL_SIZE);
+
+    float old_size = get_total_cell_size();
+    float new_size = old_size;
+    for (int i=0; i<steps; i++) {
+        new_size *= ZOOM_FACTOR;
+    }
+    for (int i=0; i>steps; i--) {
+        new_size /= ZOOM_FACTOR;
+    }
+    if (new_size < min_size) {
+        new_size = min_size;
+    }
+    if (new_size > max_size) {
+        new_size = max_size;
+    }
+    if (new_size == old_size) {
+        return 0;
+    }
+
+    // The position on the grid under (x, y), in cells
+    float u = (x - grid_layout.x_padding) / old_size;
+    float v = (y - grid_layout.y_padding) / old_size;
+
+    set_cell_size(new_size);
+    set_grid_offset(game, x - u * new_size, y - v * new_size);
+    return 1;
+}
+
+/*
+ * Move the camera so that the point (x, y) of the grid, in cells, is in the
+ * middle of the view, or as near as it can be
+ */
+void centre_camera(struct Game *game, float x, float y) {
+    float total_size = get_total_cell_size();
+    set_grid_offset(game,
+                    0.5 * (grid_layout.view_x1 + grid_layout.view_x2) -
+                    x * total_size,
+                    0.5 * (grid_layout.view_y1 + grid_layout.view_y2) -
+                    y * total_size);
+}
+
+/*
+ * Work out which cells are at least partly in view. The top left is stored
+ * in x1, y1 and the bottom right, exclusive, in x2, y2
+ */
+void get_visible_cells(struct Game *game, int *x1, int *y1, int *x2, int *y2) {
+    float total_size = get_total_cell_size();
+    *x1 = (grid_layout.view_x1 - grid_layout.x_padding) / total_size;
+    *y1 = (grid_layout.view_y1 - grid_layout.y_padding) / total_size;
+    *x2 = (grid_layout.view_x2 - grid_layout.x_padding) / total_size + 1;
+    *y2 = (grid_layout.view_y2 - grid_layout.y_padding) / total_size + 1;
+
+    *x1 = (*x1 < 0 ? 0 : *x1);
+    *y1 = (*y1 < 0 ? 0 : *y1);
+    *x2 = (*x2 > game->width ? game->width : *x2);
+    *y2 = (*y2 > game->height ? game->height : *y2);
+}
+
+/*
+ * Work out which cells of an endless board are at least partly in view, as
+ * get_visible_cells() does. There are no edges to stop at, and the cells left
+ * of or above 0, 0 have negative coordinates
+ */
+void get_visible_endless_cells(int *x1, int *y1, int *x2, int *y2) {
+    float total_size = get_total_cell_size();
+    float left = grid_layout.view_x1 - grid_layout.x_padding;
+    float top = grid_layout.view_y1 - grid_layout.y_padding;
+    float right = grid_layout.view_x2 - grid_layout.x_padding;
+    float bottom = grid_layout.view_y2 - grid_layout.y_padding;
+
+    *x1 = floorf(left / total_size);
+    *y1 = floorf(top / total_size);
+    *x2 = floorf(right / total_size) + 1;
+    *y2 = floorf(bottom / total_size) + 1;
+}
+
 /*
  * Calculate the coordinates of the corners of the rectangle for a cell.
  * Note that this is the coordinates of the visible part, i.e. not including
@@ -204,20 +636,20 @@ ALLEGRO_BITMAP *get_bitmap(char *name) {
 void get_cell_rect(struct Game *game, int x, int y, int *x1, int *y1, int *x2,
                    int *y2) {
 
-    *x1 = game->x_padding + x * (game->cell_size + 2 * game->cell_padding)
-          + game->cell_padding;
-    *y1 = game->y_padding + y * (game->cell_size + 2 * game->cell_padding)
-          + game->cell_padding;
-    *x2 = *x1 + game->cell_size;
-    *y2 = *y1 + game->cell_size;
+    float total_cell_size = get_total_cell_size();
+    *x1 = grid_layout.x_padding + x * total_cell_size + grid_layout.cell_padding;
+    *y1 = grid_layout.y_padding + y * total_cell_size + grid_layout.cell_padding;
+    *x2 = *x1 + grid_layout.cell_size;
+    *y2 = *y1 + grid_layout.cell_size;
 }
 
 /*
- * Draw an individual cell to the screen
+ * Draw how a cell with the specified value looks into the rectangle (dx1, dy1)
+ * to (dx2, dy2) of the target bitmap. This is only used to build the cell
+ * atlas - see draw_cell()
  */
-void draw_cell(struct Game *game, int x, int y, int hovered) {
-    int value = get_cell(game, x, y);
-
+void render_cell_sprite(int value, int hovered, int dx1, int dy1, int dx2,
+                        int dy2) {
     char text = 0;
     ALLEGRO_COLOR text_colour;
     ALLEGRO_COLOR cell_colour;
@@ -261,17 +693,14 @@ void draw_cell(struct Game *game, int x, int y, int hovered) {
         cell_colour = al_map_rgb(r, g, b);
     }
 
-    int dx1, dy1, dx2, dy2;
-    get_cell_rect(game, x, y, &dx1, &dy1, &dx2, &dy2);
-
     // Draw cell background colour
-    float radius = 0.5 * game->cell_size * GRID_CELL_RADIUS;
+    float radius = 0.5 * grid_layout.cell_size * GRID_CELL_RADIUS;
     al_draw_filled_rounded_rectangle(dx1, dy1, dx2, dy2, radius, radius,
                                      cell_colour);
 
     // Draw text if text has been specified
     if (text != 0) {
-        char string[] = {text};
+        char string[] = {text, '\0'};
         al_draw_text(cell_font, text_colour, 0.5 * (dx1 + dx2), dy1,
                      ALLEGRO_ALIGN_CENTRE, string);
     }
@@ -283,18 +712,215 @@ void draw_cell(struct Game *game, int x, int y, int hovered) {
 }
 
 /*
- * Draw the actual minesweeper grid to the screen
+ * Return the index of the sprite for a cell value in the cell atlas
+ */
+int get_sprite_index(int value) {
+    switch (value) {
+        case CELL_TYPE_MINE:
+            return 0;
+        case CELL_TYPE_UNKNOWN:
+            return 1;
+        case CELL_TYPE_NO_MINES:
+            return 2;
+        case CELL_TYPE_FLAG:
+            return 3;
+        default:
+            return 3 + value;  // Digits 1-8
+    }
+}
+
+/*
+ * Render every cell appearance, plain and hovered, into the cell atlas at the
+ * specified cell size. Sprites are in a row per hover state, one column per
+ * value, with a pixel gap between them so that they do not bleed into each
+ * other when drawn
+ */
+void build_cell_atlas(int size) {
+    if (cell_atlas != NULL) {
+        al_destroy_bitmap(cell_atlas);
+    }
+
+    int stride = size + 1;
+    cell_atlas = al_create_bitmap(SPRITE_COUNT * stride, 2 * stride);
+    if (cell_atlas == NULL) {
+        print_error("Failed to create cell atlas");
+        exit_app(EXIT_FAILURE);
+    }
+    cell_atlas_size = size;
+
+    ALLEGRO_BITMAP *target = al_get_target_bitmap();
+    al_set_target_bitmap(cell_atlas);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+
+    int values[SPRITE_COUNT] = {
+        CELL_TYPE_MINE, CELL_TYPE_UNKNOWN, CELL_TYPE_NO_MINES, CELL_TYPE_FLAG,
+        1, 2, 3, 4, 5, 6, 7, 8
+    };
+    for (int hovered=0; hovered<=1; hovered++) {
+        for (int i=0; i<SPRITE_COUNT; i++) {
+            int sx = get_sprite_index(values[i]) * stride;
+            int sy = hovered * stride;
+            render_cell_sprite(values[i], hovered, sx, sy, sx + size, sy + size);
+        }
+    }
+
+    al_set_target_bitmap(target);
+}
+
+/*
+ * Draw the sprite for a cell value from the cell atlas at the cell x, y
+ */
+void draw_cell_sprite(int value, int x, int y, int hovered) {
+    int dx1, dy1, dx2, dy2;
+    get_cell_rect(NULL, x, y, &dx1, &dy1, &dx2, &dy2);
+
+    int stride = cell_atlas_size + 1;
+    al_draw_bitmap_region(cell_atlas, get_sprite_index(value) * stride,
+                          hovered * stride, cell_atlas_size, cell_atlas_size,
+                          dx1, dy1, 0);
+
+    render_stats.cells_drawn++;
+    render_stats.draw_calls++;
+}
+
+/*
+ * Draw an individual cell to the screen by copying its sprite from the cell
+ * atlas. Between begin_cell_batch() and end_cell_batch() these copies are
+ * batched into a single draw
+ */
+void draw_cell(struct Game *game, int x, int y, int hovered) {
+    draw_cell_sprite(get_cell(game, x, y), x, y, hovered);
+}
+
+/*
+ * Draw a cell of an endless board, as draw_cell() does
+ */
+void draw_endless_cell(struct EndlessGame *game, int x, int y, int hovered) {
+    draw_cell_sprite(endless_get_cell(game, x, y), x, y, hovered);
+}
+
+/*
+ * Restrict drawing to the area of the display that the grid is in view in,
+ * until al_reset_clipping_rectangle() is called
+ */
+void clip_to_view() {
+    al_set_clipping_rectangle(grid_layout.view_x1, grid_layout.view_y1,
+                              grid_layout.view_x2 - grid_layout.view_x1,
+                              grid_layout.view_y2 - grid_layout.view_y1);
+}
+
+/*
+ * Start batching cell draws, so that the sprites drawn from the atlas are sent
+ * to the GPU in one go when end_cell_batch() is called. Sprites replace what
+ * was in the grid layer rather than blending with it, so redrawing a cell
+ * leaves its transparent corners transparent
+ */
+void begin_cell_batch() {
+    // Cells that are partly in view are cut off at the edge of the view
+    clip_to_view();
+    al_store_state(&cell_batch_state, ALLEGRO_STATE_BLENDER);
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+    al_hold_bitmap_drawing(true);
+}
+
+void end_cell_batch() {
+    al_hold_bitmap_drawing(false);
+    al_restore_state(&cell_batch_state);
+    al_reset_clipping_rectangle();
+    render_stats.batches++;
+}
+
+/*
+ * Draw the actual minesweeper grid to the screen. Only the cells in view are
+ * drawn, so this takes as long for a huge board as for one that fits
  */
 void draw_game(struct Game *game) {
+    double start = al_get_time();
+    long draw_calls = render_stats.draw_calls;
 
-    cell_font = al_load_ttf_font(font_path, game->cell_size, 0);
+    int x1, y1, x2, y2;
+    get_visible_cells(game, &x1, &y1, &x2, &y2);
+
+    // Clear whatever was in view before
+    clip_to_view();
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
 
     // Draw the cells
-    for (int i=0; i<game->width; i++) {
-        for (int j=0; j<game->height; j++) {
+    begin_cell_batch();
+    for (int i=x1; i<x2; i++) {
+        for (int j=y1; j<y2; j++) {
             draw_cell(game, i, j, 0);
         }
     }
+    end_cell_batch();
+
+    // Everything is up to date now
+    clear_dirty_cells(game);
+
+    render_stats.full_redraws++;
+    render_stats.last_full_redraw_time = al_get_time() - start;
+    render_stats.full_redraw_time += render_stats.last_full_redraw_time;
+    render_stats.last_full_redraw_draw_calls = render_stats.draw_calls -
+                                               draw_calls;
+}
+
+/*
+ * Draw the cells of an endless board that are in view. The endless board does
+ * not keep track of the cells that change, so this is called after every move
+ * as well as when the camera moves. The view bounds the number of cells, so it
+ * takes as long however much of the board has been explored
+ */
+void draw_endless_game(struct EndlessGame *game) {
+    double start = al_get_time();
+    long draw_calls = render_stats.draw_calls;
+
+    int x1, y1, x2, y2;
+    get_visible_endless_cells(&x1, &y1, &x2, &y2);
+
+    clip_to_view();
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+
+    begin_cell_batch();
+    for (int i=x1; i<x2; i++) {
+        for (int j=y1; j<y2; j++) {
+            draw_endless_cell(game, i, j, 0);
+        }
+    }
+    end_cell_batch();
+
+    render_stats.full_redraws++;
+    render_stats.last_full_redraw_time = al_get_time() - start;
+    render_stats.full_redraw_time += render_stats.last_full_redraw_time;
+    render_stats.last_full_redraw_draw_calls = render_stats.draw_calls -
+                                               draw_calls;
+}
+
+/*
+ * Draw only the cells that have changed since the grid was last drawn. The
+ * grid must have been drawn in full with draw_game() since the game started
+ * or the camera last moved
+ */
+void draw_dirty_cells(struct Game *game) {
+    int x1, y1, x2, y2;
+    get_visible_cells(game, &x1, &y1, &x2, &y2);
+
+    // If more cells changed than are in view (e.g. a big area was revealed),
+    // redrawing the view is quicker than going through them
+    if (game->dirty_count > (x2 - x1) * (y2 - y1)) {
+        draw_game(game);
+        return;
+    }
+
+    begin_cell_batch();
+    for (int i=0; i<game->dirty_count; i++) {
+        int x = game->dirty_cells[i] % game->stride;
+        int y = game->dirty_cells[i] / game->stride;
+        if (x >= x1 && x < x2 && y >= y1 && y < y2) {
+            draw_cell(game, x, y, 0);
+        }
+    }
+    end_cell_batch();
+    clear_dirty_cells(game);
 }
 
 /*
@@ -328,11 +954,15 @@ void draw_button(struct Button *button, int hovered) {
 }
 
 /*
- * Load a font for the specified font size and store it in the provided label
+ * Get the font for the specified font size from the font cache and store it
+ * in the provided label
  */
 void set_label_font(struct Label *label, int font_size) {
     label->font_size = font_size;
-    label->font = al_load_ttf_font(font_path, font_size, 0);
+    label->font = acquire_font(FONT_NAME, font_size);
+    if (label->font == NULL) {
+        exit_app(EXIT_FAILURE);
+    }
 }
 
 /*
@@ -374,12 +1004,24 @@ void draw_label(struct Label *label) {
 }
 
 /*
- * Draw the background colour over the provided label
+ * Clear a rectangle of the selected layer back to transparent
+ */
+void clear_rect(int x1, int y1, int x2, int y2) {
+    ALLEGRO_STATE state;
+    al_store_state(&state, ALLEGRO_STATE_BLENDER);
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+    al_draw_filled_rectangle(x1, y1, x2, y2, al_map_rgba(0, 0, 0, 0));
+    al_restore_state(&state);
+}
+
+/*
+ * Clear the area of the provided label in the selected layer back to
+ * transparent
  */
 void clear_label(struct Label *label) {
     int x1, y1, x2, y2;
     get_label_rect(label, &x1, &y1, &x2, &y2);
-    al_draw_filled_rectangle(x1, y1, x2, y2, background_colour);
+    clear_rect(x1, y1, x2, y2);
 }
 
 /*
@@ -411,11 +1053,17 @@ struct Button *get_clicked_button(struct Button **buttons, int count, int mouse_
 int get_clicked_cell(struct Game *game, int mouse_x, int mouse_y, int *x_ptr,
                      int *y_ptr) {
 
-    int x_offset = mouse_x - game->x_padding;
-    int y_offset = mouse_y - game->y_padding;
+    // Cells outside the view are hidden, even if the grid continues there
+    if (mouse_x < grid_layout.view_x1 || mouse_x >= grid_layout.view_x2 ||
+        mouse_y < grid_layout.view_y1 || mouse_y >= grid_layout.view_y2) {
+        return 0;
+    }
+
+    float x_offset = mouse_x - grid_layout.x_padding;
+    float y_offset = mouse_y - grid_layout.y_padding;
 
     // If the click was within the grid area...
-    float total_cell_size = game->cell_size + 2 * game->cell_padding;
+    float total_cell_size = get_total_cell_size();
     if (x_offset >= 0 && x_offset < game->width * total_cell_size &&
         y_offset >= 0 && y_offset < game->height * total_cell_size) {
 
@@ -436,6 +1084,32 @@ int get_clicked_cell(struct Game *game, int mouse_x, int mouse_y, int *x_ptr,
     return 0;
 }
 
+/*
+ * Work out which cell of an endless board the clicked point is inside, as
+ * get_clicked_cell() does. Every point in view is over some cell, so this only
+ * fails for points outside the view or in the padding between cells
+ */
+int get_clicked_endless_cell(int mouse_x, int mouse_y, int *x_ptr,
+                             int *y_ptr) {
+    if (mouse_x < grid_layout.view_x1 || mouse_x >= grid_layout.view_x2 ||
+        mouse_y < grid_layout.view_y1 || mouse_y >= grid_layout.view_y2) {
+        return 0;
+    }
+
+    float total_cell_size = get_total_cell_size();
+    int x = floorf((mouse_x - grid_layout.x_padding) / total_cell_size);
+    int y = floorf((mouse_y - grid_layout.y_padding) / total_cell_size);
+
+    int x1, y1, x2, y2;
+    get_cell_rect(NULL, x, y, &x1, &y1, &x2, &y2);
+    if (mouse_x >= x1 && mouse_x <= x2 && mouse_y >= y1 && mouse_y <= y2) {
+        *x_ptr = x;
+        *y_ptr = y;
+        return 1;
+    }
+    return 0;
+}
+
 /*
  * Draw a semi-transparent rectangle between the specified coordinates
  */
@@ -449,7 +1123,7 @@ void shade_screen(int x1, int y1, int x2, int y2) {
 }
 
 /*
- * Fill the whole display with the background colour
+ * Fill the selected layer with the background colour
  */
 void draw_background(int width, int height) {
     al_clear_to_color(background_colour);
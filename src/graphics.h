@@ -12,6 +12,42 @@
 // of total cell width/height
 #define CELL_PADDING 0.075
 
+// The position and size of the game grid on the display. When the grid is
+// too big to fit, this is the camera looking at part of it
+struct GridLayout {
+    float cell_size;  // The width/height of each cell in px
+
+    // The padding between the visible area of cells and the actual border
+    // between cells
+    float cell_padding;
+
+    // The x and y offsets of the grid in px. These are negative when the
+    // camera has panned past the left or top of the grid
+    float x_padding;
+    float y_padding;
+
+    // The area of the display that the grid is drawn in
+    int view_x1;
+    int view_y1;
+    int view_x2;
+    int view_y2;
+
+    // The cell size (including padding) at which the whole grid fits in view
+    float fit_size;
+};
+
+/*
+ * The offscreen layers that a frame is composited from, bottom to top. Each
+ * is only redrawn when its own contents change
+ */
+enum Layer {
+    LAYER_BACKGROUND,
+    LAYER_GRID,     // The cells of the current game
+    LAYER_HUD,      // The flag count and timer
+    LAYER_OVERLAY,  // Menus, drawn over the game when it ends
+    LAYER_COUNT
+};
+
 struct Button {
     char label[MAX_BUTTON_LENGTH];
 
@@ -41,19 +77,68 @@ struct Label {
     ALLEGRO_FONT *font;
 };
 
+/*
+ * Counters for measuring how much drawing the grid takes. A draw call is one
+ * sprite drawn from the cell atlas, and a batch is a group of them sent to
+ * the GPU at once
+ */
+struct RenderStats {
+    long cells_drawn;
+    long draw_calls;
+    long batches;
+
+    // Full redraws of the grid by draw_game(), and the time spent issuing
+    // them. The GPU may still be drawing after this, until the next flip
+    long full_redraws;
+    double full_redraw_time;
+    double last_full_redraw_time;
+    long last_full_redraw_draw_calls;
+
+    // Frames composited from the layers, and the layers drawn to make them
+    long composites;
+    long layer_blits;
+};
+
+extern struct RenderStats render_stats;
+extern struct GridLayout grid_layout;
+
 int init_allegro(int width, int height, ALLEGRO_DISPLAY **display,
-                 ALLEGRO_EVENT_QUEUE **event_queue, ALLEGRO_TIMER **timer);
+                 ALLEGRO_EVENT_QUEUE **event_queue);
+int init_layers(ALLEGRO_DISPLAY *display);
+void select_layer(enum Layer layer);
+void clear_layer(enum Layer layer);
+void set_layer_visible(enum Layer layer, int visible);
+void composite_layers();
 ALLEGRO_BITMAP *get_bitmap(char *name);
+void preload_images();
+ALLEGRO_FONT *acquire_font(const char *name, int size);
+void release_font(ALLEGRO_FONT *font);
+void set_grid_layout(struct Game *game, int display_width, int display_height);
+void set_endless_layout(int display_width, int display_height);
+int pan_camera(struct Game *game, float dx, float dy);
+int zoom_camera(struct Game *game, int steps, int x, int y);
+void centre_camera(struct Game *game, float x, float y);
+void get_visible_cells(struct Game *game, int *x1, int *y1, int *x2, int *y2);
+void get_visible_endless_cells(int *x1, int *y1, int *x2, int *y2);
+void build_cell_atlas(int size);
 void draw_cell(struct Game *game, int x, int y, int hovered);
+void draw_endless_cell(struct EndlessGame *game, int x, int y, int hovered);
+void begin_cell_batch();
+void end_cell_batch();
 void draw_game(struct Game *game);
+void draw_dirty_cells(struct Game *game);
+void draw_endless_game(struct EndlessGame *game);
 void draw_button(struct Button *button, int hovered);
 void set_label_font(struct Label *label, int font_size);
 void draw_label(struct Label *label);
+void clear_rect(int x1, int y1, int x2, int y2);
 void clear_label(struct Label *label);
 struct Button *get_clicked_button(struct Button **buttons, int count, int mouse_x,
                                   int mouse_y);
 int get_clicked_cell(struct Game *game, int mouse_x, int mouse_y, int *x_ptr,
                      int *y_ptr);
+int get_clicked_endless_cell(int mouse_x, int mouse_y, int *x_ptr,
+                             int *y_ptr);
 void shade_screen(int x1, int y1, int x2, int y2);
 void draw_background();
 void draw_image(char *name, int x, int y, int width, int height);
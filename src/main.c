@@ -1,17 +1,27 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_font.h>
 
 #include "minesweeper.h"
+#include "endless.h"
+#include "rng.h"
+#include "generator.h"
+#include "threadpool.h"
 #include "graphics.h"
+#include "minimap.h"
+#include "savefile.h"
+#include "recording.h"
 #include "error.h"
 
 #define DISPLAY_WIDTH 900
 #define DISPLAY_HEIGHT 700
 
-#define MAIN_MENU_BUTTON_COUNT 3
+#define MAIN_MENU_BUTTON_COUNT 6
 #define POST_GAME_MENU_BUTTON_COUNT 3
 
 // The width/height for icons (e.g. flags remaining and timer icos)
@@ -20,6 +30,29 @@
 // The horizontal padding for the flags remaining/timer labels
 #define FLAG_TIMER_PADDING 10
 
+// How long after each second boundary to update the game timer, in seconds
+#define TIMER_WAKE_UP_DELAY 0.001
+
+// The longest a new no-guess board may take to generate, in seconds. If none
+// is found in time an ordinary board is used instead
+#define NO_GUESS_TIME_BUDGET 0.1
+
+// The most cells a board can have for no-guess generation to be tried. The
+// solver needs scratch space for every cell on every thread, so bigger boards
+// only get a safe opening
+#define NO_GUESS_MAX_CELLS 250000
+
+// The mine density of endless boards, about that of the large preset
+#define ENDLESS_DENSITY 0.2
+
+// How far the arrow keys move the camera, in px
+#define PAN_STEP 100
+
+// The file a game in progress is saved to when the window is closed, in the
+// user's home directory
+#define SAVE_FILE_NAME ".minesweeper-save"
+#define SAVE_PATH_LENGTH 4096
+
 enum AppState {
     MAIN_MENU,
     IN_GAME,
@@ -30,11 +63,26 @@ enum AppState {
 struct App {
     enum AppState state;
     struct Game game;
+    int game_initialised;
+    struct Minimap minimap;
+
+    // Holds the memory of each new game, which replaces the last one's
+    struct Arena arena;
+
+    // Whether the game in progress is on an endless board, which is played in
+    // endless rather than game, and when that board was started
+    int playing_endless;
+    struct EndlessGame endless;
+    int endless_initialised;
+    time_t endless_timestamp;
 
     // Main menu buttons and labels
     struct Button small_game_button;
     struct Button medium_game_button;
     struct Button large_game_button;
+    struct Button huge_game_button;
+    struct Button endless_game_button;
+    struct Button no_guess_button;
     struct Label title_label;
     struct Label flags_label;
 
@@ -48,14 +96,40 @@ struct App {
     struct Button *main_menu_buttons[MAIN_MENU_BUTTON_COUNT];
     struct Button *post_game_menu_buttons[POST_GAME_MENU_BUTTON_COUNT];
 
-    // The button/cell that is current being hovered over
+    // The button/cell that is current being hovered over. On an endless
+    // board the cell is hovered_x, hovered_y, if endless_hovered is set
     struct Button *hovered_button;
     int hovered_cell;
+    int endless_hovered;
+    int hovered_x;
+    int hovered_y;
+
+    // Whether the camera is being dragged with the middle mouse button, and
+    // where the mouse was when it last moved it
+    int dragging;
+    int drag_x;
+    int drag_y;
 
     // Label to show elapsed time
     struct Label timer_label;
 
     int redraw_required;
+
+    // Generates the seed for each new game
+    struct Rng rng;
+
+    // Whether new games are generated so that they can be solved without
+    // guessing, and the generator used to do so
+    int no_guess;
+    struct ThreadPool pool;
+    struct Generator generator;
+
+    // Where the game in progress is saved, or empty if there is nowhere to
+    // save it
+    char save_path[SAVE_PATH_LENGTH];
+
+    // Records the input of each game, if --record was given
+    struct Recorder recorder;
 };
 
 /*
@@ -67,6 +141,9 @@ union StateChangeParams {
         int width;
         int height;
         int mine_count;
+
+        // Whether to start an endless board, which has no size or mine count
+        int endless;
     } game_settings;
 
     // This is used when changing to POST_GAME
@@ -77,8 +154,13 @@ union StateChangeParams {
  * Update the label that shows the number of flags remaning
  */
 void update_flags_label(struct App *app) {
+    // An endless board has no mine count, so it shows the flags placed instead
+    int flags = (app->playing_endless ? app->endless.flags_placed :
+                 app->game.flags_remaining);
+
+    select_layer(LAYER_HUD);
     clear_label(&(app->flags_label));
-    sprintf(app->flags_label.text, "%d", app->game.flags_remaining);
+    sprintf(app->flags_label.text, "%d", flags);
     draw_label(&(app->flags_label));
     app->redraw_required = 1;
 }
@@ -89,10 +171,13 @@ void update_flags_label(struct App *app) {
 void update_game_timer(struct App *app) {
     if (app->state == IN_GAME) {
         static int elapsed_seconds = -1;
-        int new_elapsed_seconds = time(NULL)- app->game.timestamp;
+        time_t timestamp = (app->playing_endless ? app->endless_timestamp :
+                            app->game.timestamp);
+        int new_elapsed_seconds = time(NULL)- timestamp;
 
         if (new_elapsed_seconds != elapsed_seconds) {
             elapsed_seconds = new_elapsed_seconds;
+            select_layer(LAYER_HUD);
             clear_label(&(app->timer_label));
             sprintf(app->timer_label.text, "%ds", elapsed_seconds);
             draw_label(&(app->timer_label));
@@ -101,6 +186,92 @@ void update_game_timer(struct App *app) {
     }
 }
 
+/*
+ * Set the label of the no-guess toggle button to show the current setting
+ */
+void set_no_guess_label(struct App *app) {
+    strcpy(app->no_guess_button.label,
+           (app->no_guess ? "No guess: On" : "No guess: Off"));
+}
+
+/*
+ * Initialise the game for a new round, as a no-guess board if that mode is
+ * on. No-guess boards start with their opening revealed, since they are only
+ * guaranteed to be solvable from that cell. Boards too big to generate that
+ * way just start with an opening. The board replaces the last one in the
+ * app's arena, so once the biggest board played so far has been started,
+ * starting another allocates nothing. Return 1 if successful, 0 otherwise
+ */
+int start_game(struct App *app, int width, int height, int mine_count) {
+    // Free the previous board if it was loaded from a save. Otherwise it is
+    // in the arena, and is simply replaced
+    if (app->game_initialised) {
+        free_game(&(app->game));
+        app->game_initialised = 0;
+    }
+
+    uint64_t seed = rng_next(&(app->rng));
+    if (!init_game_in_arena(&(app->game), &(app->arena), width, height,
+                            mine_count, seed)) {
+        return 0;
+    }
+    app->game_initialised = 1;
+
+    if (!app->no_guess) {
+        record_game_start(&(app->recorder), &(app->game), -1, -1);
+        return 1;
+    }
+
+    int start_x = width / 2;
+    int start_y = height / 2;
+    if (width * height > NO_GUESS_MAX_CELLS) {
+        if (!reset_game_with_opening(&(app->game), seed, start_x, start_y)) {
+            return 0;
+        }
+    }
+    else {
+        if (app->generator.capacity < width * height) {
+            free_generator(&(app->generator));
+            if (!init_generator(&(app->generator), width * height,
+                                &(app->pool))) {
+                return 0;
+            }
+        }
+
+        struct GeneratorResult result;
+        if (!generate_no_guess_game(&(app->generator), &(app->game), seed,
+                                    start_x, start_y, NO_GUESS_TIME_BUDGET,
+                                    &result)) {
+            return 0;
+        }
+    }
+
+    reveal_cell(&(app->game), start_x, start_y);
+    record_game_start(&(app->recorder), &(app->game), start_x, start_y);
+    return 1;
+}
+
+/*
+ * Start a new endless board in place of the last one, with the area around
+ * 0, 0 revealed, since the cells next to it never have mines. The no-guess
+ * setting does not apply. Return 1 if successful, 0 otherwise
+ */
+int start_endless_game(struct App *app) {
+    if (app->endless_initialised) {
+        free_endless_game(&(app->endless));
+        app->endless_initialised = 0;
+    }
+
+    if (!init_endless_game(&(app->endless), rng_next(&(app->rng)),
+                           ENDLESS_DENSITY)) {
+        return 0;
+    }
+    app->endless_initialised = 1;
+    app->endless_timestamp = time(NULL);
+
+    return endless_reveal_cell(&(app->endless), 0, 0);
+}
+
 /*
  * Initialise an App struct by creating the menu buttons and initialising
  * member variables
@@ -111,9 +282,14 @@ void init_app(struct App *app) {
     strcpy(app->small_game_button.label, "Small");
     strcpy(app->medium_game_button.label, "Medium");
     strcpy(app->large_game_button.label, "Large");
+    strcpy(app->huge_game_button.label, "Huge");
+    strcpy(app->endless_game_button.label, "Endless");
     app->main_menu_buttons[0] = &(app->small_game_button);
     app->main_menu_buttons[1] = &(app->medium_game_button);
     app->main_menu_buttons[2] = &(app->large_game_button);
+    app->main_menu_buttons[3] = &(app->huge_game_button);
+    app->main_menu_buttons[4] = &(app->endless_game_button);
+    app->main_menu_buttons[5] = &(app->no_guess_button);
 
     // Create the post-game menu buttons
     strcpy(app->replay_game_button.label, "Play again");
@@ -165,6 +341,119 @@ void init_app(struct App *app) {
 
     app->hovered_button = NULL;
     app->hovered_cell = -1;
+    app->endless_hovered = 0;
+    app->dragging = 0;
+    app->game_initialised = 0;
+    app->playing_endless = 0;
+    app->endless_initialised = 0;
+    init_arena(&(app->arena));
+    memset(&(app->minimap), 0, sizeof(app->minimap));
+    app->recorder.file = NULL;
+
+    const char *home = getenv("HOME");
+    app->save_path[0] = '\0';
+    if (home != NULL &&
+        strlen(home) + strlen(SAVE_FILE_NAME) + 2 <= SAVE_PATH_LENGTH) {
+        sprintf(app->save_path, "%s/%s", home, SAVE_FILE_NAME);
+    }
+
+    rng_seed(&(app->rng), time(NULL));
+
+    // The generator is sized for the board when the first no-guess game starts
+    app->no_guess = 0;
+    set_no_guess_label(app);
+    memset(&(app->generator), 0, sizeof(app->generator));
+    if (!init_thread_pool(&(app->pool), 0)) {
+        exit_app(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Show the game that has just been started or loaded, in place of the menus
+ */
+void show_game(struct App *app) {
+    set_layer_visible(LAYER_GRID, 1);
+    set_layer_visible(LAYER_HUD, 1);
+    set_layer_visible(LAYER_OVERLAY, 0);
+
+    if (app->playing_endless) {
+        set_endless_layout(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        clear_layer(LAYER_GRID);
+        draw_endless_game(&(app->endless));
+    }
+    else {
+        set_grid_layout(&(app->game), DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        if (!init_minimap(&(app->minimap), &(app->game))) {
+            exit_app(EXIT_FAILURE);
+        }
+        clear_layer(LAYER_GRID);
+        draw_game(&(app->game));
+    }
+    app->hovered_cell = -1;
+    app->endless_hovered = 0;
+    app->dragging = 0;
+
+    // Draw flag icon next to flags remaining label
+    clear_layer(LAYER_HUD);
+    draw_image("flag.png", FLAG_TIMER_PADDING,
+               app->flags_label.y - 0.5 * ICON_SIZE, ICON_SIZE, ICON_SIZE);
+    strcpy(app->flags_label.text, "0");
+    update_flags_label(app);
+
+    // Draw clock icon next to timer label
+    select_layer(LAYER_HUD);
+    draw_image("clock.png", DISPLAY_WIDTH - FLAG_TIMER_PADDING - ICON_SIZE,
+               app->timer_label.y - 0.5 * ICON_SIZE, ICON_SIZE, ICON_SIZE);
+
+    // Show the minimap if the board does not fit in view. An endless board
+    // has no edges for it to show
+    if (app->playing_endless) {
+        clear_minimap(&(app->minimap));
+    }
+    else {
+        draw_minimap(&(app->minimap), &(app->game));
+    }
+
+    app->redraw_required = 1;
+}
+
+/*
+ * Save the game in progress, so that it can be carried on next time. Endless
+ * boards are not saved
+ */
+void save_app_game(struct App *app) {
+    if (app->state == IN_GAME && !app->playing_endless &&
+        app->game_initialised && app->save_path[0] != '\0') {
+        save_game(&(app->game), app->save_path);
+    }
+}
+
+/*
+ * Carry on the game that was saved last time, if there is one and it was not
+ * over. The save file is mapped rather than read, so this takes no longer for
+ * a huge board. Return 1 if a game was resumed, 0 otherwise
+ */
+int resume_saved_game(struct App *app) {
+    if (app->save_path[0] == '\0' || access(app->save_path, F_OK) != 0) {
+        return 0;
+    }
+
+    // The whole file is checked, since it may be left over from a crash. A
+    // save that cannot be loaded never will be, so it is removed
+    if (!load_game(&(app->game), app->save_path, 1)) {
+        remove(app->save_path);
+        return 0;
+    }
+    if (lost_game(&(app->game)) || won_game(&(app->game))) {
+        free_game(&(app->game));
+        return 0;
+    }
+
+    app->game_initialised = 1;
+    app->playing_endless = 0;
+    app->state = IN_GAME;
+    show_game(app);
+    return 1;
 }
 
 /*
@@ -177,7 +466,12 @@ void change_app_state(struct App *app, enum AppState new_state,
     if (new_state == MAIN_MENU) {
         app->hovered_button = NULL;
 
-        draw_background();
+        // The menu replaces the game, if there was one
+        set_layer_visible(LAYER_GRID, 0);
+        set_layer_visible(LAYER_HUD, 0);
+        set_layer_visible(LAYER_OVERLAY, 1);
+
+        clear_layer(LAYER_OVERLAY);
         draw_label(&(app->title_label));
 
         // Draw main menu buttons
@@ -189,28 +483,19 @@ void change_app_state(struct App *app, enum AppState new_state,
     }
 
     else if (new_state == IN_GAME) {
-        if (init_game(&(app->game), params.game_settings.width,
-                      params.game_settings.height,
-                      params.game_settings.mine_count, DISPLAY_WIDTH,
-                      DISPLAY_HEIGHT, GRID_PADDING, CELL_PADDING)) {
-
-            draw_background();
-            draw_game(&(app->game));
-
-            // Draw flag icon next to flags remaining label
-            draw_image("flag.png", FLAG_TIMER_PADDING,
-                       app->flags_label.y - 0.5 * ICON_SIZE, ICON_SIZE,
-                       ICON_SIZE);
-            strcpy(app->flags_label.text, "0");
-            update_flags_label(app);
-
-            // Draw clock icon next to timer label
-            draw_image("clock.png",
-                       DISPLAY_WIDTH - FLAG_TIMER_PADDING - ICON_SIZE,
-                       app->timer_label.y - 0.5 * ICON_SIZE, ICON_SIZE,
-                       ICON_SIZE);
+        int started;
+        app->playing_endless = params.game_settings.endless;
+        if (app->playing_endless) {
+            started = start_endless_game(app);
+        }
+        else {
+            started = start_game(app, params.game_settings.width,
+                                 params.game_settings.height,
+                                 params.game_settings.mine_count);
+        }
 
-            app->redraw_required = 1;
+        if (started) {
+            show_game(app);
         }
         else {
             exit_app(EXIT_FAILURE);
@@ -220,7 +505,15 @@ void change_app_state(struct App *app, enum AppState new_state,
     else if (new_state == POST_GAME_MENU) {
         app->hovered_button = NULL;
 
-        // Shade over the grid
+        // A finished game is not carried on next time
+        if (app->save_path[0] != '\0') {
+            remove(app->save_path);
+        }
+        record_game_end(&(app->recorder), &(app->game));
+
+        // Shade over the grid, which stays as it was underneath
+        set_layer_visible(LAYER_OVERLAY, 1);
+        clear_layer(LAYER_OVERLAY);
         shade_screen(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
 
         // Show game result label
@@ -238,36 +531,101 @@ void change_app_state(struct App *app, enum AppState new_state,
     app->state = new_state;
 }
 
+/*
+ * Redraw the cells in view, and where the minimap shows the view to be,
+ * after the camera has moved
+ */
+void redraw_grid(struct App *app) {
+    select_layer(LAYER_GRID);
+    if (app->playing_endless) {
+        draw_endless_game(&(app->endless));
+    }
+    else {
+        draw_game(&(app->game));
+        select_layer(LAYER_HUD);
+        draw_minimap(&(app->minimap), &(app->game));
+    }
+
+    // The hovered cell has been drawn over
+    app->hovered_cell = -1;
+    app->endless_hovered = 0;
+    app->redraw_required = 1;
+}
+
+/*
+ * Reveal/toggle flag the clicked cell of an endless board, as handle_click()
+ * does for other boards. Recordings only hold boards with edges, so this is
+ * not recorded. An endless board cannot be won, so the game only ends when a
+ * mine is revealed
+ */
+void handle_endless_click(struct App *app, int mouse_x, int mouse_y,
+                          int mouse_button) {
+    int x, y;
+    if ((mouse_button != 1 && mouse_button != 2) ||
+        !get_clicked_endless_cell(mouse_x, mouse_y, &x, &y)) {
+        return;
+    }
+
+    if (!endless_click_cell(&(app->endless), x, y, mouse_button)) {
+        exit_app(EXIT_FAILURE);
+    }
+    if (mouse_button == 2) {
+        update_flags_label(app);
+    }
+
+    // The endless board does not list the cells that changed, so the view is
+    // redrawn
+    redraw_grid(app);
+
+    if (app->endless.mine_exploded) {
+        union StateChangeParams params;
+        params.won_game = 0;
+        change_app_state(app, POST_GAME_MENU, params);
+    }
+}
+
 /*
  * Callback function for an allegro mouse button up event. Reveal/toggle flag
  * a cell if in game, or respond to button presses in menus
  */
 void handle_click(struct App *app, int mouse_x, int mouse_y, int mouse_button) {
-    if (app->state == IN_GAME) {
+    if (app->state == IN_GAME && app->playing_endless) {
+        handle_endless_click(app, mouse_x, mouse_y, mouse_button);
+    }
+    else if (app->state == IN_GAME) {
+        // The middle button only drags the camera, and releasing it ends the
+        // drag wherever it is, even over the minimap or a cell
+        if (mouse_button == 3) {
+            return;
+        }
+
+        // Clicking the minimap moves the camera to that part of the board
+        float map_x, map_y;
+        if (get_clicked_minimap(&(app->minimap), mouse_x, mouse_y, &map_x,
+                                &map_y)) {
+            centre_camera(&(app->game), map_x, map_y);
+            redraw_grid(app);
+            return;
+        }
+
         int x, y;
         if (get_clicked_cell(&(app->game), mouse_x, mouse_y, &x, &y)) {
 
-            // Left click
-            if (mouse_button == 1) {
-                int cell = get_cell(&(app->game), x, y);
-
-                // If this cell is unknown then reveal it
-                if (cell == CELL_TYPE_UNKNOWN){
-                    reveal_cell(&(app->game), x, y);
-                }
-                // If the cell is not revealed and not a flag, then 'click' all
-                // neighbouring cells
-                else if (cell != CELL_TYPE_FLAG) {
-                    reveal_neighobouring_cells(&(app->game), x, y);
-                }
-            }
-            // Right click - toggle flag
-            else if (mouse_button == 2) {
-                toggle_flag(&(app->game), x, y);
+            // Left click reveals the cell, or its neighbours if it is
+            // already revealed, and right click toggles a flag
+            record_click(&(app->recorder), x, y, mouse_button);
+            click_cell(&(app->game), x, y, mouse_button);
+            if (mouse_button == 2) {
                 update_flags_label(app);
             }
 
-            draw_game(&(app->game));
+            // Only redraw the cells that the click changed, in the grid and
+            // the minimap
+            update_minimap(&(app->minimap), &(app->game));
+            select_layer(LAYER_GRID);
+            draw_dirty_cells(&(app->game));
+            select_layer(LAYER_HUD);
+            draw_minimap(&(app->minimap), &(app->game));
             app->redraw_required = 1;
 
             if (lost_game(&(app->game))) {
@@ -288,8 +646,15 @@ void handle_click(struct App *app, int mouse_x, int mouse_y, int mouse_button) {
         struct Button *button = get_clicked_button(app->main_menu_buttons,
                                                    MAIN_MENU_BUTTON_COUNT,
                                                    mouse_x, mouse_y);
-        if (button != NULL) {
+        if (button == &(app->no_guess_button)) {
+            union StateChangeParams params;
+            app->no_guess = !app->no_guess;
+            set_no_guess_label(app);
+            change_app_state(app, MAIN_MENU, params);
+        }
+        else if (button != NULL) {
             union StateChangeParams params;
+            params.game_settings.endless = 0;
 
             if (button == &(app->small_game_button)) {
                 params.game_settings.width = 8;
@@ -306,6 +671,14 @@ void handle_click(struct App *app, int mouse_x, int mouse_y, int mouse_button) {
                 params.game_settings.height = 16;
                 params.game_settings.mine_count = 99;
             }
+            else if (button == &(app->huge_game_button)) {
+                params.game_settings.width = 2000;
+                params.game_settings.height = 2000;
+                params.game_settings.mine_count = 640000;
+            }
+            else if (button == &(app->endless_game_button)) {
+                params.game_settings.endless = 1;
+            }
             change_app_state(app, IN_GAME, params);
         }
     }
@@ -320,6 +693,7 @@ void handle_click(struct App *app, int mouse_x, int mouse_y, int mouse_button) {
                 params.game_settings.width = app->game.width;
                 params.game_settings.height = app->game.height;
                 params.game_settings.mine_count = app->game.mine_count;
+                params.game_settings.endless = app->playing_endless;
                 change_app_state(app, IN_GAME, params);
             }
             else if (button == &(app->go_to_main_menu_button)) {
@@ -332,11 +706,97 @@ void handle_click(struct App *app, int mouse_x, int mouse_y, int mouse_button) {
     }
 }
 
+/*
+ * Callback function for a mouse button down event. Dragging with the middle
+ * button pans the camera in game
+ */
+void handle_mouse_down(struct App *app, int mouse_x, int mouse_y,
+                       int mouse_button) {
+    if (app->state == IN_GAME && mouse_button == 3) {
+        app->dragging = 1;
+        app->drag_x = mouse_x;
+        app->drag_y = mouse_y;
+    }
+}
+
+/*
+ * Callback function for a key press (including repeats). The arrow keys pan
+ * the camera and +/- zoom it in game
+ */
+void handle_key(struct App *app, int keycode) {
+    if (app->state != IN_GAME) {
+        return;
+    }
+
+    // The camera is not kept in view of an endless board, which has no edges
+    struct Game *game = (app->playing_endless ? NULL : &(app->game));
+
+    int moved = 0;
+    switch (keycode) {
+        case ALLEGRO_KEY_LEFT:
+            moved = pan_camera(game, PAN_STEP, 0);
+            break;
+        case ALLEGRO_KEY_RIGHT:
+            moved = pan_camera(game, -PAN_STEP, 0);
+            break;
+        case ALLEGRO_KEY_UP:
+            moved = pan_camera(game, 0, PAN_STEP);
+            break;
+        case ALLEGRO_KEY_DOWN:
+            moved = pan_camera(game, 0, -PAN_STEP);
+            break;
+        case ALLEGRO_KEY_EQUALS:
+        case ALLEGRO_KEY_PAD_PLUS:
+            moved = zoom_camera(game, 1, DISPLAY_WIDTH / 2,
+                                DISPLAY_HEIGHT / 2);
+            break;
+        case ALLEGRO_KEY_MINUS:
+        case ALLEGRO_KEY_PAD_MINUS:
+            moved = zoom_camera(game, -1, DISPLAY_WIDTH / 2,
+                                DISPLAY_HEIGHT / 2);
+            break;
+    }
+
+    if (moved) {
+        redraw_grid(app);
+    }
+}
+
+/*
+ * Hover the cell of the endless board under the mouse, and unhover the one
+ * that was, if it has changed
+ */
+void hover_endless_cell(struct App *app, int mouse_x, int mouse_y) {
+    int x, y;
+    int hovered = get_clicked_endless_cell(mouse_x, mouse_y, &x, &y);
+    if (hovered == app->endless_hovered &&
+        (!hovered || (x == app->hovered_x && y == app->hovered_y))) {
+        return;
+    }
+
+    select_layer(LAYER_GRID);
+    begin_cell_batch();
+    if (app->endless_hovered) {
+        draw_endless_cell(&(app->endless), app->hovered_x, app->hovered_y, 0);
+    }
+    if (hovered) {
+        draw_endless_cell(&(app->endless), x, y, 1);
+        app->hovered_x = x;
+        app->hovered_y = y;
+    }
+    end_cell_batch();
+
+    app->endless_hovered = hovered;
+    app->redraw_required = 1;
+}
+
 /*
  * Callback function for a mouse move event. Handle hovering of buttons in the
- * menus and cells in the game
+ * menus and cells in the game, and in game move the camera if the mouse is
+ * dragging it or the wheel scrolled zoom_steps steps
  */
-void handle_mouse_move(struct App *app, int mouse_x, int mouse_y) {
+void handle_mouse_move(struct App *app, int mouse_x, int mouse_y,
+                       int zoom_steps) {
     if (app->state == MAIN_MENU || app->state == POST_GAME_MENU) {
 
         // Work out which buttons to check for hovering
@@ -355,6 +815,8 @@ void handle_mouse_move(struct App *app, int mouse_x, int mouse_y) {
                                                    mouse_x, mouse_y);
 
         if (button != app->hovered_button) {
+            select_layer(LAYER_OVERLAY);
+
             // If there is currently a button being hovered which has now lost
             // focus, unhover it
             if (app->hovered_button != NULL) {
@@ -375,10 +837,34 @@ void handle_mouse_move(struct App *app, int mouse_x, int mouse_y) {
         }
     }
     else if (app->state == IN_GAME) {
+        struct Game *game = (app->playing_endless ? NULL : &(app->game));
+        int moved = 0;
+        if (zoom_steps != 0) {
+            moved |= zoom_camera(game, zoom_steps, mouse_x, mouse_y);
+        }
+        if (app->dragging) {
+            moved |= pan_camera(game, mouse_x - app->drag_x,
+                                mouse_y - app->drag_y);
+            app->drag_x = mouse_x;
+            app->drag_y = mouse_y;
+        }
+        if (moved) {
+            redraw_grid(app);
+        }
+
+        if (app->playing_endless) {
+            hover_endless_cell(app, mouse_x, mouse_y);
+            return;
+        }
+
         // Note: This is largely the same logic as above, but for hovering cells
         // whilst in game
+        // Cells under the minimap cannot be hovered
         int pos, x, y;
-        if (get_clicked_cell(&(app->game), mouse_x, mouse_y, &x, &y)) {
+        float map_x, map_y;
+        if (!get_clicked_minimap(&(app->minimap), mouse_x, mouse_y, &map_x,
+                                 &map_y) &&
+            get_clicked_cell(&(app->game), mouse_x, mouse_y, &x, &y)) {
             pos = x + y * app->game.width;
         }
         else {
@@ -386,6 +872,9 @@ void handle_mouse_move(struct App *app, int mouse_x, int mouse_y) {
         }
 
         if (pos != app->hovered_cell) {
+            select_layer(LAYER_GRID);
+            begin_cell_batch();
+
             if (app->hovered_cell >= 0) {
                 int hover_x = app->hovered_cell % app->game.width;
                 int hover_y = app->hovered_cell / app->game.width;
@@ -396,69 +885,299 @@ void handle_mouse_move(struct App *app, int mouse_x, int mouse_y) {
                 draw_cell(&(app->game), x, y, 1);
                 app->redraw_required = 1;
             }
+            end_cell_batch();
             app->hovered_cell = pos;
         }
     }
 }
 
+// When the program started, and how long it took to show the first frame, in
+// seconds. first_frame_time is negative until then
+double start_time;
+double first_frame_time = -1;
+
+/*
+ * Return the current time in seconds from a monotonic clock
+ */
+double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * The time from input events to the frame that shows their effect, in seconds
+ */
+struct LatencyStats {
+    long count;
+    double total;
+    double max;
+
+    // The timestamp (from al_get_time()) of the earliest input that has been
+    // drawn but not presented yet, or negative if there is none
+    double pending_input;
+};
+
+struct LatencyStats input_latency = {0, 0, 0, -1};
+
+/*
+ * Counts of the events taken from the queue, and of the handler calls made for
+ * them once mouse movement has been coalesced
+ */
+struct EventStats {
+    long received;
+    long processed;
+    long batches;
+};
+
+struct EventStats event_stats = {0, 0, 0};
+
+/*
+ * Composite the layers into a frame and show it, recording how long the first one took
+ * from startup and how long ago the input it shows arrived. With vsync on,
+ * al_flip_display() waits for the display to take the frame, so this measures
+ * up to when it is actually shown
+ */
+void present_frame() {
+    composite_layers();
+    al_flip_display();
+    if (first_frame_time < 0) {
+        first_frame_time = get_time() - start_time;
+    }
+
+    if (input_latency.pending_input >= 0) {
+        double latency = al_get_time() - input_latency.pending_input;
+        input_latency.count++;
+        input_latency.total += latency;
+        if (latency > input_latency.max) {
+            input_latency.max = latency;
+        }
+        input_latency.pending_input = -1;
+    }
+}
+
+/*
+ * Return how long to wait, in seconds, until the game timer next needs
+ * updating, or -1 to wait indefinitely. The elapsed time is counted in whole
+ * seconds of the wall clock, so it changes on each second boundary
+ */
+double get_wake_up_time(struct App *app) {
+    if (app->state != IN_GAME) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    // Wake just after the boundary, so that time() has moved on
+    return 1.0 - now.tv_nsec * 1e-9 + TIMER_WAKE_UP_DELAY;
+}
+
+/*
+ * Print measurements of the rendering to stderr. This is registered with
+ * atexit() when the game is run with --profile
+ */
+void print_profile() {
+    fprintf(stderr, "startup to first frame:   %.3f ms\n",
+            first_frame_time * 1000);
+    fprintf(stderr, "events received:          %ld\n", event_stats.received);
+    fprintf(stderr, "events processed:         %ld in %ld batches\n",
+            event_stats.processed, event_stats.batches);
+    if (input_latency.count > 0) {
+        fprintf(stderr, "input to present:         %.3f ms mean, %.3f ms max "
+                "over %ld frames\n",
+                input_latency.total * 1000 / input_latency.count,
+                input_latency.max * 1000, input_latency.count);
+    }
+    fprintf(stderr, "full grid redraws:        %ld\n", render_stats.full_redraws);
+    if (render_stats.full_redraws > 0) {
+        fprintf(stderr, "last full redraw:         %ld draw calls, %.3f ms\n",
+                render_stats.last_full_redraw_draw_calls,
+                render_stats.last_full_redraw_time * 1000);
+        fprintf(stderr, "mean full redraw time:    %.3f ms\n",
+                render_stats.full_redraw_time * 1000 /
+                render_stats.full_redraws);
+    }
+    fprintf(stderr, "cells drawn:              %ld\n", render_stats.cells_drawn);
+    fprintf(stderr, "draw calls:               %ld\n", render_stats.draw_calls);
+    fprintf(stderr, "batches:                  %ld\n", render_stats.batches);
+    fprintf(stderr, "frames composited:        %ld from %ld layer blits\n",
+            render_stats.composites, render_stats.layer_blits);
+}
+
+/*
+ * Handle every event that is waiting, starting with first. Mouse movement is
+ * collapsed to the latest position, and wheel scrolling to the total number
+ * of steps, which are handled once at the end of the batch, or before the
+ * next click or key press so that those still happen in order and with the
+ * hover state and camera up to date
+ */
+void handle_events(struct App *app, ALLEGRO_EVENT_QUEUE *event_queue,
+                   ALLEGRO_EVENT *first) {
+    ALLEGRO_EVENT event = *first;
+    int move_pending = 0;
+    int move_x = 0;
+    int move_y = 0;
+    int zoom_steps = 0;
+
+    event_stats.batches++;
+    do {
+        event_stats.received++;
+
+        if (move_pending && (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN ||
+                             event.type == ALLEGRO_EVENT_MOUSE_BUTTON_UP ||
+                             event.type == ALLEGRO_EVENT_KEY_CHAR)) {
+            handle_mouse_move(app, move_x, move_y, zoom_steps);
+            event_stats.processed++;
+            move_pending = 0;
+            zoom_steps = 0;
+        }
+
+        // Close window if close button was pressed, keeping any game in
+        // progress for next time
+        if (event.type == ALLEGRO_EVENT_DISPLAY_CLOSE) {
+            save_app_game(app);
+            if (app->state == IN_GAME) {
+                record_game_end(&(app->recorder), &(app->game));
+            }
+            close_recorder(&(app->recorder));
+            exit_app(EXIT_SUCCESS);
+        }
+
+        // Handle mouse clicks
+        else if (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN) {
+            handle_mouse_down(app, event.mouse.x, event.mouse.y,
+                              event.mouse.button);
+            event_stats.processed++;
+        }
+        else if (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_UP) {
+            if (event.mouse.button == 3) {
+                app->dragging = 0;
+            }
+            handle_click(app, event.mouse.x, event.mouse.y, event.mouse.button);
+            event_stats.processed++;
+        }
+
+        // Mouse movement - used to detect when a button is hovered, and to
+        // move the camera
+        else if (event.type == ALLEGRO_EVENT_MOUSE_AXES) {
+            move_pending = 1;
+            move_x = event.mouse.x;
+            move_y = event.mouse.y;
+            zoom_steps += event.mouse.dz;
+        }
+
+        // Key presses, repeated while the key is held
+        else if (event.type == ALLEGRO_EVENT_KEY_CHAR) {
+            handle_key(app, event.keyboard.keycode);
+            event_stats.processed++;
+        }
+
+        // The window was uncovered or switched back to, so its contents may
+        // have been lost. The layers are kept offscreen, so the frame only
+        // needs compositing again
+        else if (event.type == ALLEGRO_EVENT_DISPLAY_EXPOSE ||
+                 event.type == ALLEGRO_EVENT_DISPLAY_SWITCH_IN ||
+                 event.type == ALLEGRO_EVENT_DISPLAY_FOUND) {
+            app->redraw_required = 1;
+        }
+    } while (al_get_next_event(event_queue, &event));
+
+    if (move_pending) {
+        handle_mouse_move(app, move_x, move_y, zoom_steps);
+        event_stats.processed++;
+    }
+}
+
 int main(int argc, char **args) {
-    srand(time(NULL));
+    start_time = get_time();
+
+    int preload = 1;
+    const char *record_path = NULL;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(args[i], "--profile") == 0) {
+            atexit(print_profile);
+        }
+        else if (strcmp(args[i], "--no-preload") == 0) {
+            preload = 0;
+        }
+        else if (strcmp(args[i], "--record") == 0 && i + 1 < argc) {
+            record_path = args[++i];
+        }
+        else {
+            fprintf(stderr, "usage: minesweeper [--profile] [--no-preload] "
+                    "[--record FILE]\n");
+            exit_app(EXIT_FAILURE);
+        }
+    }
 
     // Initialise allegro related things
     ALLEGRO_DISPLAY *display;
     ALLEGRO_EVENT_QUEUE *event_queue;
-    ALLEGRO_TIMER *timer;
-    if (!init_allegro(DISPLAY_WIDTH, DISPLAY_HEIGHT, &display, &event_queue,
-                      &timer)) {
+    if (!init_allegro(DISPLAY_WIDTH, DISPLAY_HEIGHT, &display, &event_queue)) {
         exit_app(EXIT_FAILURE);
     }
 
-    // Initialise app and set state to main menu
+    // The background layer never changes, so it is only drawn once
+    select_layer(LAYER_BACKGROUND);
+    draw_background();
+
+    // Decode the images up front so that nothing is loaded mid-game
+    if (preload) {
+        preload_images();
+    }
+
+    // Initialise app, and carry on the saved game if there is one, otherwise
+    // set state to main menu
     struct App app;
     init_app(&app);
-    union StateChangeParams params;
-    change_app_state(&app, MAIN_MENU, params);
+    if (record_path != NULL && !open_recorder(&(app.recorder), record_path)) {
+        exit_app(EXIT_FAILURE);
+    }
+    if (!resume_saved_game(&app)) {
+        union StateChangeParams params;
+        change_app_state(&app, MAIN_MENU, params);
+    }
 
-    // Main loop
+    // Main loop. Each time round, every waiting event is handled, and then
+    // anything drawn is presented straight away. Otherwise the loop sleeps
+    // until the next event, or the next time the game timer changes if a game
+    // is in progress
     while (1) {
+        update_game_timer(&app);
 
-        ALLEGRO_EVENT event;
-        ALLEGRO_TIMEOUT timeout;
-        al_init_timeout(&timeout, 0.06);
-
-        // Wait for an event to be received or for timeout
-        bool event_received = al_wait_for_event_until(event_queue, &event,
-                                                      &timeout);
-
-        if (event_received) {
-            // Close window if close button was pressed
-            if (event.type == ALLEGRO_EVENT_DISPLAY_CLOSE) {
-                exit_app(EXIT_SUCCESS);
-            }
+        if (app.redraw_required) {
+            present_frame();
+            app.redraw_required = 0;
+        }
 
-            // Handle mouse clicks
-            else if (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_UP) {
-                handle_click(&app, event.mouse.x, event.mouse.y,
-                             event.mouse.button);
-            }
+        ALLEGRO_EVENT event;
+        bool event_received;
+        double wake_up_time = get_wake_up_time(&app);
+
+        if (wake_up_time >= 0) {
+            ALLEGRO_TIMEOUT timeout;
+            al_init_timeout(&timeout, wake_up_time);
+            event_received = al_wait_for_event_until(event_queue, &event,
+                                                     &timeout);
+        }
+        else {
+            al_wait_for_event(event_queue, &event);
+            event_received = true;
+        }
 
-            // Handle mouse movement - used to detect when a button is hovered
-            else if (event.type == ALLEGRO_EVENT_MOUSE_AXES) {
-                handle_mouse_move(&app, event.mouse.x, event.mouse.y);
-            }
+        if (!event_received) {
+            continue;
+        }
 
-            // Timer events signify when the display can be redrawn and when
-            // time elapsed can be updated
-            else if (event.type == ALLEGRO_EVENT_TIMER) {
-                update_game_timer(&app);
+        handle_events(&app, event_queue, &event);
 
-                if (app.redraw_required) {
-                    al_flip_display();
-                    app.redraw_required = 0;
-                }
-            }
+        // Time how long input that changed the screen takes to be shown, from
+        // the first event of the batch
+        if (app.redraw_required && input_latency.pending_input < 0) {
+            input_latency.pending_input = event.any.timestamp;
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -2,12 +2,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "minesweeper.h"
+#include "rng.h"
 #include "error.h"
 
-#define MAX_WIDTH  99
-#define MAX_HEIGHT 99
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_DISPATCH
+#endif
+
+// The number of cells stored in each word of the mine bitset
+#define MINE_BITS_PER_WORD 64
+
+// The value of a cell as the player sees it: a flag, unknown, a mine that has
+// been shown, or the number of adjacent mines once revealed
+#define CELL_VALUE(c) ((c) & CELL_FLAGGED ? CELL_TYPE_FLAG : \
+                       !((c) & CELL_REVEALED) ? CELL_TYPE_UNKNOWN : \
+                       (c) & CELL_MINE ? CELL_TYPE_MINE : \
+                       ((c) & CELL_COUNT_MASK) == 0 ? CELL_TYPE_NO_MINES : \
+                       ((c) & CELL_COUNT_MASK))
+#define CELL_VALUES_4(c) CELL_VALUE(c), CELL_VALUE(c + 1), CELL_VALUE(c + 2), \
+                         CELL_VALUE(c + 3)
+#define CELL_VALUES_16(c) CELL_VALUES_4(c), CELL_VALUES_4(c + 4), \
+                          CELL_VALUES_4(c + 8), CELL_VALUES_4(c + 12)
+#define CELL_VALUES_64(c) CELL_VALUES_16(c), CELL_VALUES_16(c + 16), \
+                          CELL_VALUES_16(c + 32), CELL_VALUES_16(c + 48)
+
+// Decoding a cell is a lookup, rather than a chain of branches on its bits
+const signed char cell_values[256] = {
+    CELL_VALUES_64(0), CELL_VALUES_64(64), CELL_VALUES_64(128),
+    CELL_VALUES_64(192)
+};
 
 /*
  * Check that the provided coordinates are in range. Return 1 if they are,
@@ -27,32 +54,49 @@ int valid_coords(struct Game *game, int x, int y) {
  */
 int get_cell(struct Game *game, int x, int y) {
     if (valid_coords(game, x, y)) {
-        return game->cells[x + y * game->width];
+        return decode_cell(game->cells[x + y * game->stride]);
     }
 }
 
 /*
- * Set the value of a cell in the grid for the specified game. Return 1 if set
- * succesfully, 0 otherwise
+ * Add the cell at index to the list of cells that have changed, if it is not
+ * already in it
  */
-int set_cell(struct Game *game, int x, int y, int value) {
-    if (valid_coords(game, x, y)) {
-        game->cells[x + y * game->width] = value;
-        return 1;
+static inline void mark_dirty(struct Game *game, int index) {
+    if (!(game->cells[index] & CELL_DIRTY)) {
+        game->cells[index] |= CELL_DIRTY;
+        game->dirty_cells[game->dirty_count++] = index;
     }
-    else {
-        return 0;
+}
+
+/*
+ * Empty the list of changed cells, once they have been redrawn
+ */
+void clear_dirty_cells(struct Game *game) {
+    for (int i=0; i<game->dirty_count; i++) {
+        game->cells[game->dirty_cells[i]] &= ~CELL_DIRTY;
     }
+    game->dirty_count = 0;
+}
+
+/*
+ * Return the number of 64-bit words needed for a mine bitset covering the
+ * specified number of cells
+ */
+int mine_bits_words(int cell_count) {
+    return (cell_count + MINE_BITS_PER_WORD - 1) / MINE_BITS_PER_WORD;
 }
 
 /*
- * Set the locations of the mines in the grid
+ * Reveal the locations of the mines in the grid, including any that are
+ * flagged
  */
 void show_mines(struct Game *game) {
     for (int i=0; i<game->mine_count; i++) {
-        int x = game->mines[i] % game->width;
-        int y = game->mines[i] / game->width;
-        set_cell(game, x, y, CELL_TYPE_MINE);
+        int index = cell_index(game, game->mines[i]);
+        game->cells[index] = (game->cells[index] | CELL_REVEALED) &
+                             ~CELL_FLAGGED;
+        mark_dirty(game, index);
     }
 }
 
@@ -60,41 +104,294 @@ void show_mines(struct Game *game) {
  * Return 1 if there is a mine at the specified coordinates, 0 otherwise
  */
 int is_mine(struct Game *game, int x, int y) {
-    int position = x + y * game->width;
-    for (int i=0; i<game->mine_count; i++) {
-        if (game->mines[i] == position) {
-            return 1;
+    return (game->cells[x + y * game->stride] & CELL_MINE) != 0;
+}
+
+/*
+ * Row kernels for compute_adjacent_counts(). Each one takes pointers to the
+ * first real cell of three consecutive rows of a zero-bordered byte plane
+ * (one byte per cell, 1 for a mine) and writes the sum of the 8 neighbours of
+ * each cell in the middle row to out, with CELL_MINE set if the cell itself
+ * is a mine. The scalar kernel starts at column start so that the vector
+ * kernels can use it for the tail of a row
+ */
+typedef void (*CountRowKernel)(const unsigned char *above,
+                               const unsigned char *row,
+                               const unsigned char *below, unsigned char *out,
+                               int width);
+
+static void count_row_scalar(const unsigned char *above,
+                             const unsigned char *row,
+                             const unsigned char *below, unsigned char *out,
+                             int start, int width) {
+    for (int x=start; x<width; x++) {
+        out[x] = above[x - 1] + above[x] + above[x + 1]
+                 + row[x - 1] + row[x + 1]
+                 + below[x - 1] + below[x] + below[x + 1]
+                 + row[x] * CELL_MINE;
+    }
+}
+
+static void count_row_generic(const unsigned char *above,
+                              const unsigned char *row,
+                              const unsigned char *below, unsigned char *out,
+                              int width) {
+    count_row_scalar(above, row, below, out, 0, width);
+}
+
+#ifdef __SSE2__
+static void count_row_sse2(const unsigned char *above,
+                           const unsigned char *row,
+                           const unsigned char *below, unsigned char *out,
+                           int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i sum = _mm_loadu_si128((const __m128i *) (above + x - 1));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i *) (above + x)));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i *) (above + x + 1)));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i *) (row + x - 1)));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i *) (row + x + 1)));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i *) (below + x - 1)));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i *) (below + x)));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((const __m128i *) (below + x + 1)));
+
+        // The plane's bytes are 0 or 1, so shifting 16-bit lanes moves each
+        // byte's bit to CELL_MINE without crossing into the next byte
+        __m128i mine = _mm_loadu_si128((const __m128i *) (row + x));
+        sum = _mm_add_epi8(sum, _mm_slli_epi16(mine, 4));
+        _mm_storeu_si128((__m128i *) (out + x), sum);
+    }
+    count_row_scalar(above, row, below, out, x, width);
+}
+#endif
+
+#ifdef HAVE_X86_DISPATCH
+__attribute__((target("avx2")))
+static void count_row_avx2(const unsigned char *above,
+                           const unsigned char *row,
+                           const unsigned char *below, unsigned char *out,
+                           int width) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i sum = _mm256_loadu_si256((const __m256i *) (above + x - 1));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i *) (above + x)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i *) (above + x + 1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i *) (row + x - 1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i *) (row + x + 1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i *) (below + x - 1)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i *) (below + x)));
+        sum = _mm256_add_epi8(sum, _mm256_loadu_si256((const __m256i *) (below + x + 1)));
+
+        // See count_row_sse2()
+        __m256i mine = _mm256_loadu_si256((const __m256i *) (row + x));
+        sum = _mm256_add_epi8(sum, _mm256_slli_epi16(mine, 4));
+        _mm256_storeu_si256((__m256i *) (out + x), sum);
+    }
+    count_row_scalar(above, row, below, out, x, width);
+}
+#endif
+
+/*
+ * Pick the fastest row kernel supported by the CPU we are running on, and
+ * store its name in name_ptr if it is not NULL
+ */
+static CountRowKernel select_count_row_kernel(const char **name_ptr) {
+    static CountRowKernel kernel = NULL;
+    static const char *name = NULL;
+
+    if (kernel == NULL) {
+        kernel = count_row_generic;
+        name = "scalar";
+#ifdef __SSE2__
+        kernel = count_row_sse2;
+        name = "sse2";
+#endif
+#ifdef HAVE_X86_DISPATCH
+        if (__builtin_cpu_supports("avx2")) {
+            kernel = count_row_avx2;
+            name = "avx2";
+        }
+#endif
+    }
+
+    if (name_ptr != NULL) {
+        *name_ptr = name;
+    }
+    return kernel;
+}
+
+/*
+ * Return the name of the kernel used by compute_adjacent_counts()
+ */
+const char *adjacent_counts_kernel() {
+    const char *name;
+    select_count_row_kernel(&name);
+    return name;
+}
+
+/*
+ * Set every cell to unrevealed, holding its number of adjacent mines and
+ * whether it is a mine, from the mine bitset, and fill in the border of
+ * sentinel cells. This also empties the list of changed cells. The mines are
+ * expanded into a byte plane laid out like the cells, with a border of empty
+ * cells on every side, so that each row of counts is the sum of 8 shifted rows
+ * of the plane with no bounds checks, and each row of cells is written in one
+ * go. The plane is kept with the game, so this allocates nothing. Return 1 if
+ * successful, 0 otherwise
+ */
+int compute_adjacent_counts(struct Game *game) {
+    int stride = game->stride;
+    unsigned char *plane = game->count_plane;
+    memset(plane, 0, (game->height + 2) * stride);
+
+    int words = mine_bits_words(game->width * game->height);
+    for (int i=0; i<words; i++) {
+        uint64_t word = game->mine_bits[i];
+        while (word != 0) {
+            int position = i * MINE_BITS_PER_WORD + __builtin_ctzll(word);
+            int x = position % game->width;
+            int y = position / game->width;
+            plane[(y + 1) * stride + x + 1] = 1;
+            word &= word - 1;
         }
     }
 
-    return 0;
+    CountRowKernel kernel = select_count_row_kernel(NULL);
+    for (int y=0; y<game->height; y++) {
+        const unsigned char *row = plane + (y + 1) * stride + 1;
+        unsigned char *cells = game->cells + y * stride;
+        kernel(row - stride, row, row + stride, cells, game->width);
+        cells[-1] = CELL_SENTINEL;
+        cells[game->width] = CELL_SENTINEL;
+    }
+    memset(game->cells - stride - 1, CELL_SENTINEL, stride);
+    memset(game->cells + game->height * stride - 1, CELL_SENTINEL, stride);
+    game->dirty_count = 0;
+
+    return 1;
 }
 
 /*
  * Return the number of mines adjacent to the specified location
  */
 int adjacent_mines(struct Game *game, int x, int y) {
-    int count = 0;
-    for (int dx=-1; dx<=1; dx++) {
-        for (int dy=-1; dy<=1; dy++) {
+    return game->cells[x + y * game->stride] & CELL_COUNT_MASK;
+}
 
-            // Skip this cell if (dx, dy) == (x, y)
-            if (dx == 0 && dy == 0) {
-                continue;
-            }
+/*
+ * Add a mine at the specified position to the mine bitset and the list of
+ * mines
+ */
+void add_mine(struct Game *game, int position, int index) {
+    game->mine_bits[position / MINE_BITS_PER_WORD] |=
+        (uint64_t) 1 << (position % MINE_BITS_PER_WORD);
+    game->mines[index] = position;
+}
 
-            // Skip if this cell is not in the grid
-            if (!valid_coords(game, x + dx, y + dy)) {
-                continue;
-            }
+/*
+ * Map an index into the cells that are not excluded to the position of that
+ * cell. excluded must be in ascending order
+ */
+int skip_excluded(int index, const int *excluded, int excluded_count) {
+    for (int i=0; i<excluded_count && excluded[i] <= index; i++) {
+        index++;
+    }
+    return index;
+}
+
+/*
+ * Choose mine_count distinct cells uniformly at random, other than the
+ * excluded ones, using the game's random number generator. This uses Floyd's
+ * sampling algorithm, which draws exactly one random number per mine: for
+ * each j in [n - m, n), pick t in [0, j] and use t unless it has already been
+ * chosen, in which case use j (which cannot have been chosen yet). The mine
+ * bitset is the set of chosen cells, so the whole placement is O(mine_count)
+ */
+void place_mines(struct Game *game, const int *excluded, int excluded_count) {
+    int cell_count = game->width * game->height - excluded_count;
+    int index = 0;
+
+    for (int j=cell_count - game->mine_count; j<cell_count; j++) {
+        int t = skip_excluded(rng_below(&(game->rng), j + 1), excluded,
+                              excluded_count);
+        uint64_t bit = (uint64_t) 1 << (t % MINE_BITS_PER_WORD);
+
+        if (game->mine_bits[t / MINE_BITS_PER_WORD] & bit) {
+            add_mine(game, skip_excluded(j, excluded, excluded_count), index++);
+        }
+        else {
+            add_mine(game, t, index++);
+        }
+    }
+}
+
+/*
+ * Set the dimensions of a game's grid, and the stride and neighbour offsets
+ * that go with them. This does not allocate the cells
+ */
+void set_grid_size(struct Game *game, int width, int height) {
+    game->width = width;
+    game->height = height;
+    game->stride = width + 2;
 
-            if (is_mine(game, x + dx, y + dy)) {
-                count++;
+    int offset = 0;
+    for (int dy=-1; dy<=1; dy++) {
+        for (int dx=-1; dx<=1; dx++) {
+            if (dx != 0 || dy != 0) {
+                game->neighbour_offsets[offset++] = dx + dy * game->stride;
             }
         }
     }
+}
+
+/*
+ * Print an error and return 0 if a board of the given size and mine count is
+ * not allowed, otherwise return 1
+ */
+static int check_game_size(int width, int height, int mine_count) {
+    if (width < 1 || width > MAX_WIDTH || height < 1 || height > MAX_HEIGHT) {
+        print_error("Invalid grid dimensions");
+        return 0;
+    }
+
+    if (mine_count < 0 || mine_count > width * height) {
+        print_error("Invalid mine count");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Return the size of the cells (including their border), the count plane,
+ * the mines, the mine bitset, the reveal stack and the list of changed cells
+ * for a board, in the order they are allocated
+ */
+static void get_buffer_sizes(int width, int height, int mine_count,
+                             size_t sizes[6]) {
+    size_t cell_count = (size_t) width * height;
+    sizes[0] = (size_t) (width + 2) * (height + 2);
+    sizes[1] = sizes[0];
+    sizes[2] = sizeof(int) * mine_count;
+    sizes[3] = sizeof(uint64_t) * mine_bits_words(cell_count);
+    sizes[4] = sizeof(int) * cell_count;
+    sizes[5] = sizeof(int) * cell_count;
+}
 
-    return count;
+/*
+ * Point the game's buffers at the memory for each of them, as ordered by
+ * get_buffer_sizes()
+ */
+static void set_buffers(struct Game *game, void *buffers[6]) {
+    // Point cells past the top border and the left border of the first row
+    unsigned char *cells = buffers[0];
+    game->cells = (cells != NULL ? cells + game->stride + 1 : NULL);
+    game->count_plane = buffers[1];
+    game->mines = buffers[2];
+    game->mine_bits = buffers[3];
+    game->reveal_stack = buffers[4];
+    game->dirty_cells = buffers[5];
+    game->dirty_count = 0;
 }
 
 /*
@@ -102,122 +399,259 @@ int adjacent_mines(struct Game *game, int x, int y) {
  * otherwise
  */
 int init_game(struct Game *game, int width, int height, int mine_count,
-              int display_width, int display_height, int grid_padding,
-              float cell_padding) {
+              uint64_t seed) {
 
     // Initialise the grid
-    if (width < 1 || width > MAX_WIDTH || height < 1 || height > MAX_HEIGHT) {
-        print_error("Invalid grid dimensions");
+    if (!check_game_size(width, height, mine_count)) {
         return 0;
     }
 
-    game->width = width;
-    game->height = height;
+    set_grid_size(game, width, height);
+    game->mine_count = mine_count;
+    game->mapping = NULL;
+    game->mapping_size = 0;
+    game->arena = NULL;
+
+    size_t sizes[6];
+    void *buffers[6];
+    get_buffer_sizes(width, height, mine_count, sizes);
+    for (int i=0; i<6; i++) {
+        buffers[i] = malloc(sizes[i]);
+    }
+    set_buffers(game, buffers);
+    if (game->cells == NULL || game->count_plane == NULL ||
+        game->mines == NULL || game->mine_bits == NULL ||
+        game->reveal_stack == NULL || game->dirty_cells == NULL) {
+        print_error("Failed to allocate memory for the game");
+        return 0;
+    }
 
-    game->cells = malloc(sizeof(int) * game->width * game->height);
-    for (int y=0; y<game->height; y++) {
-        for (int x=0; x<game->width; x++) {
-            set_cell(game, x, y, CELL_TYPE_UNKNOWN);
-        }
+    return reset_game(game, seed);
+}
+
+/*
+ * Return the number of bytes an arena needs to hold a game of the given size,
+ * as allocated by init_game_in_arena()
+ */
+size_t game_memory_size(int width, int height, int mine_count) {
+    size_t sizes[6];
+    get_buffer_sizes(width, height, mine_count, sizes);
+
+    size_t total = 0;
+    for (int i=0; i<6; i++) {
+        total += arena_size(sizes[i]);
+    }
+    return total;
+}
+
+/*
+ * Initialise the game as init_game() does, but with all of its memory taken
+ * from arena, which is emptied first. The arena only allocates if the board
+ * is bigger than any it has held before, so starting game after game this way
+ * allocates nothing once the arena has grown. Whatever game was using the
+ * arena before is replaced, and free_game() does not need to be called for
+ * it. Return 1 if succesful, 0 otherwise
+ */
+int init_game_in_arena(struct Game *game, struct Arena *arena, int width,
+                       int height, int mine_count, uint64_t seed) {
+    if (!check_game_size(width, height, mine_count) ||
+        !reserve_arena(arena, game_memory_size(width, height, mine_count))) {
+        return 0;
     }
 
+    set_grid_size(game, width, height);
     game->mine_count = mine_count;
-    game->mines = malloc(sizeof(int) * mine_count);
+    game->mapping = NULL;
+    game->mapping_size = 0;
+    game->arena = arena;
+
+    size_t sizes[6];
+    void *buffers[6];
+    get_buffer_sizes(width, height, mine_count, sizes);
+    for (int i=0; i<6; i++) {
+        buffers[i] = arena_alloc(arena, sizes[i]);
+    }
+    set_buffers(game, buffers);
+
+    return reset_game(game, seed);
+}
+
+/*
+ * Clear the board and place mines from seed, away from the excluded cells
+ * (positions in ascending order). Return 1 if succesful, 0 otherwise
+ */
+int start_game(struct Game *game, uint64_t seed, const int *excluded,
+               int excluded_count) {
+    memset(game->mine_bits, 0,
+           sizeof(uint64_t) * mine_bits_words(game->width * game->height));
     game->cells_revealed = 0;
     game->mine_exploded = 0;
-    game->flags_remaining = mine_count;
-
-    // Position the mines
-    int mines_placed = 0;
-    while (mines_placed < mine_count) {
-        int r = rand() % (width * height);
-
-        // Check that we have not already placed a mine in this position
-        int collision = 0;
-        for (int i=0; i<mines_placed; i++) {
-            if (r == game->mines[i]) {
-                collision = 1;
+    game->flags_remaining = game->mine_count;
+
+    game->seed = seed;
+    rng_seed(&(game->rng), seed);
+    place_mines(game, excluded, excluded_count);
+
+    // This clears every cell. The whole board is drawn at the start of a
+    // game, so the cells are not marked as changed
+    if (!compute_adjacent_counts(game)) {
+        return 0;
+    }
+
+    game->timestamp = time(NULL);
+
+    return 1;
+}
+
+/*
+ * Start a new game on an initialised board, with the same dimensions and mine
+ * count but the mines placed from seed. This reuses the board's memory, so it
+ * is cheaper than free_game() followed by init_game(). Return 1 if succesful,
+ * 0 otherwise
+ */
+int reset_game(struct Game *game, uint64_t seed) {
+    return start_game(game, seed, NULL, 0);
+}
+
+/*
+ * Like reset_game(), but keep mines away from (x, y) and its neighbours, so
+ * that revealing (x, y) first opens up an area. If there are too many mines
+ * for that then only (x, y) itself is kept clear, if possible. The same seed
+ * and starting cell always give the same board. Return 1 if succesful, 0
+ * otherwise
+ */
+int reset_game_with_opening(struct Game *game, uint64_t seed, int x, int y) {
+    int excluded[9];
+    int excluded_count = 0;
+
+    if (valid_coords(game, x, y)) {
+        for (int ny=y - 1; ny<=y + 1; ny++) {
+            for (int nx=x - 1; nx<=x + 1; nx++) {
+                if (valid_coords(game, nx, ny)) {
+                    excluded[excluded_count++] = nx + ny * game->width;
+                }
             }
         }
 
-        if (!collision) {
-            game->mines[mines_placed] = r;
-            mines_placed++;
+        if (game->mine_count > game->width * game->height - excluded_count) {
+            excluded[0] = x + y * game->width;
+            excluded_count = 1;
+        }
+        if (game->mine_count > game->width * game->height - excluded_count) {
+            excluded_count = 0;
         }
     }
 
-    // Calculate cell width and padding in px
-    float x = (float) (display_width - 2 * grid_padding) / game->width;
-    float y = (float) (display_height - 2 * grid_padding) / game->height;
-    float total_size = (x < y ? x : y);
-
-    // cell_padding is a percentage of total cell size
-    game->cell_padding = total_size * cell_padding;
-    game->cell_size = total_size - 2 * game->cell_padding;
-
-    // Work out grid offsets
-    game->x_padding = (display_width - total_size * game->width) / 2;
-    game->y_padding = (display_height - total_size * game->height) / 2;
+    return start_game(game, seed, excluded, excluded_count);
+}
 
-    game->timestamp = time(NULL);
+/*
+ * Free the memory allocated for a game by init_game() or load_game(). A game
+ * initialised by init_game_in_arena() has nothing to free, since its arena
+ * owns its memory
+ */
+void free_game(struct Game *game) {
+    if (game->arena != NULL) {
+        game->arena = NULL;
+        return;
+    }
 
-    return 1;
+    if (game->mapping != NULL) {
+        munmap(game->mapping, game->mapping_size);
+        game->mapping = NULL;
+    }
+    else {
+        if (game->cells != NULL) {
+            free(game->cells - game->stride - 1);
+        }
+        free(game->mines);
+        free(game->mine_bits);
+    }
+    free(game->count_plane);
+    free(game->reveal_stack);
+    free(game->dirty_cells);
 }
 
+void reveal_index(struct Game *game, int index);
+
 /*
  * Reveal all cells adjacent to the specified cell
  */
 void reveal_neighobouring_cells(struct Game *game, int x, int y) {
-    for (int dx=-1; dx<=1; dx++) {
-        for (int dy=-1; dy<=1; dy++) {
+    if (!valid_coords(game, x, y)) {
+        return;
+    }
 
-            int newX = x + dx;
-            int newY = y + dy;
+    int index = x + y * game->stride;
+    for (int i=0; i<8; i++) {
+        int neighbour = index + game->neighbour_offsets[i];
 
-            // Skip if (x + dx, y + dy) is not in the grid
-            if (!valid_coords(game, newX, newY)) {
-                continue;
-            }
+        // Skip this cell if it has already been revealed or flagged. This
+        // also skips the border around the grid
+        if (game->cells[neighbour] & (CELL_REVEALED | CELL_FLAGGED)) {
+            continue;
+        }
 
-            // Skip this cell if it has already been revealed
-            if (get_cell(game, newX, newY) != CELL_TYPE_UNKNOWN) {
-                continue;
-            }
+        reveal_index(game, neighbour);
+    }
+}
 
-            reveal_cell(game, newX, newY);
-        }
+/*
+ * Set a cell that does not contain a mine to its number of adjacent mines, or
+ * to 'no mines' if there are none. If there are no adjacent mines, push the
+ * cell onto the reveal stack so that its neighbours get revealed too
+ */
+void uncover_cell(struct Game *game, int index, int *stack_size) {
+    game->cells[index] = (game->cells[index] | CELL_REVEALED) & ~CELL_FLAGGED;
+    game->cells_revealed++;
+    mark_dirty(game, index);
+
+    if ((game->cells[index] & CELL_COUNT_MASK) == 0) {
+        game->reveal_stack[(*stack_size)++] = index;
     }
 }
 
 /*
  * Reveal a cell. If the cell contains a mine, set the mine_exploded flag and
  * return. If there are any adjacent mines, set the cell to the number and
- * return. If there are no adjacent mines, recursively reveal all adjacent cells
- * that have not already been revealed
+ * return. If there are no adjacent mines, reveal all adjacent cells that have
+ * not already been revealed, and keep going for as long as this uncovers more
+ * cells with no adjacent mines.
+ *
+ * The cascade uses game->reveal_stack rather than recursion, so its depth does
+ * not depend on the size of the opening. Each cell is pushed at most once
+ * because it is revealed before it is pushed, so the stack never holds more
+ * than width * height cells
  */
 void reveal_cell(struct Game *game, int x, int y) {
-    if (is_mine(game, x, y)) {
+    reveal_index(game, x + y * game->stride);
+}
+
+/*
+ * Reveal the cell at index into game->cells, as reveal_cell() does
+ */
+void reveal_index(struct Game *game, int index) {
+    unsigned char *cells = game->cells;
+    if (cells[index] & CELL_MINE) {
         show_mines(game);
         game->mine_exploded = 1;
+        return;
     }
-    else {
-        game->cells_revealed++;
-        int n = adjacent_mines(game, x, y);
-        int cell_value;
-
-        // Set the cell to 'no mines' if there are no adjacent mines, otherwise
-        // set it to the number of adjacent mines
-        if (n == 0) {
-            cell_value = CELL_TYPE_NO_MINES;
-        }
-        else {
-            cell_value = n;
-        }
 
-        set_cell(game, x, y, cell_value);
+    int stack_size = 0;
+    uncover_cell(game, index, &stack_size);
 
-        if (n == 0) {
-            reveal_neighobouring_cells(game, x, y);
+    while (stack_size > 0) {
+        int current = game->reveal_stack[--stack_size];
+
+        // Revealed or flagged neighbours, including the border around the
+        // grid, are skipped here. None of the neighbours can be a mine, since
+        // the cell has no adjacent mines
+        for (int i=0; i<8; i++) {
+            int neighbour = current + game->neighbour_offsets[i];
+            if (!(cells[neighbour] & (CELL_REVEALED | CELL_FLAGGED))) {
+                uncover_cell(game, neighbour, &stack_size);
+            }
         }
     }
 }
@@ -227,17 +661,77 @@ void reveal_cell(struct Game *game, int x, int y) {
  * unknown if it is currently a flag
  */
 void toggle_flag(struct Game *game, int x, int y) {
-    int cell_value = get_cell(game, x, y);
+    if (!valid_coords(game, x, y)) {
+        return;
+    }
+
+    int index = x + y * game->stride;
+    if (game->cells[index] & CELL_REVEALED) {
+        return;
+    }
+
+    game->cells[index] ^= CELL_FLAGGED;
+    game->flags_remaining += (game->cells[index] & CELL_FLAGGED ? -1 : 1);
+    mark_dirty(game, index);
+}
+
+/*
+ * Respond to a click on a cell, as the game does. A left click (button 1)
+ * reveals the cell if it is unknown, or reveals its neighbours if it is
+ * already revealed. A right click (button 2) toggles a flag
+ */
+void click_cell(struct Game *game, int x, int y, int button) {
+    if (!valid_coords(game, x, y)) {
+        return;
+    }
 
-    if (cell_value == CELL_TYPE_UNKNOWN) {
-        set_cell(game, x, y, CELL_TYPE_FLAG);
-        game->flags_remaining--;
+    if (button == 1) {
+        int cell = get_cell(game, x, y);
+        if (cell == CELL_TYPE_UNKNOWN) {
+            reveal_cell(game, x, y);
+        }
+        else if (cell != CELL_TYPE_FLAG) {
+            reveal_neighobouring_cells(game, x, y);
+        }
     }
+    else if (button == 2) {
+        toggle_flag(game, x, y);
+    }
+}
 
-    else if (cell_value == CELL_TYPE_FLAG) {
-        set_cell(game, x, y, CELL_TYPE_UNKNOWN);
-        game->flags_remaining++;
+/*
+ * Return a hash of the state of the board: every cell except whether it has
+ * been drawn, and the counters. Two games hash the same if they would play
+ * the same from here on
+ */
+uint64_t hash_game(struct Game *game) {
+    uint64_t hash = game->width + ((uint64_t) game->height << 32);
+    uint64_t counters[2] = {
+        game->cells_revealed + ((uint64_t) game->flags_remaining << 32),
+        game->mine_exploded
+    };
+
+    // Each row is mixed in 8 cells at a time, with the last word of the row
+    // padded with zeros. The words are built a byte at a time, so the hash is
+    // the same whatever the byte order of the machine
+    for (int y=0; y<game->height; y++) {
+        const unsigned char *row = game->cells + y * game->stride;
+        for (int x=0; x<game->width; x += 8) {
+            uint64_t word = 0;
+            int count = (game->width - x < 8 ? game->width - x : 8);
+            for (int i=0; i<count; i++) {
+                word |= (uint64_t) (row[x + i] & ~CELL_DIRTY) << (8 * i);
+            }
+            hash = (((hash << 31) | (hash >> 33)) ^ word) *
+                   0x9e3779b97f4a7c15ULL;
+        }
+    }
+    for (int i=0; i<2; i++) {
+        hash = (((hash << 31) | (hash >> 33)) ^ counters[i]) *
+               0x9e3779b97f4a7c15ULL;
     }
+
+    return hash;
 }
 
 /*
@@ -6,12 +6,71 @@
 #define CELL_TYPE_NO_MINES -3
 #define CELL_TYPE_FLAG -4
 
+// The largest board dimensions allowed
+#define MAX_WIDTH  4096
+#define MAX_HEIGHT 4096
+
+// The bits of a cell in Game.cells. get_cell() turns these into the values
+// above
+#define CELL_COUNT_MASK 0x0f  // The number of adjacent mines
+#define CELL_MINE 0x10
+#define CELL_REVEALED 0x20
+#define CELL_FLAGGED 0x40
+#define CELL_DIRTY 0x80       // Set if the cell is in the list of changed cells
+
+// The value of the border cells around the grid. They look revealed, so they
+// are never revealed, flagged or pushed onto the reveal stack
+#define CELL_SENTINEL CELL_REVEALED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rng.h"
+#include "arena.h"
+
 struct Game {
     int width;
     int height;
-    int *cells;
+
+    // One byte per cell, made up of the CELL_ bits, stored row by row with
+    // stride (width + 2) bytes per row. The number of adjacent mines is
+    // computed when the game is initialised. The grid has a border of one
+    // sentinel cell on every side that looks revealed, so code walking the
+    // neighbours of a cell needs no bounds checks. cells points at cell 0, 0,
+    // so cell x, y is cells[x + y * stride], including the border at x or y
+    // -1 and x == width or y == height
+    unsigned char *cells;
+    int stride;
+
+    // The offsets in cells from a cell to each of its 8 neighbours
+    int neighbour_offsets[8];
+
     int mine_count;
+
+    // The positions (x + y * width) of the mines, in the order they were placed.
+    // This is only used for iterating over the mines - use mine_bits to test
+    // whether a cell contains a mine
     int *mines;
+
+    // A packed bitset with one bit per cell, set if the cell contains a mine.
+    // This is used to place the mines and count their neighbours
+    uint64_t *mine_bits;
+
+    // Work stack of indices into cells used by reveal_cell() when cascading
+    // through cells with no adjacent mines. This has room for every cell
+    int *reveal_stack;
+
+    // The indices into cells (x + y * stride) of the cells whose values have
+    // changed since the list was last cleared with clear_dirty_cells(), so
+    // that only those need to be redrawn. Cells in the list have their
+    // CELL_DIRTY bit set
+    int *dirty_cells;
+    int dirty_count;
+
+    // Scratch space for compute_adjacent_counts(), laid out like cells
+    unsigned char *count_plane;
+
     int cells_revealed;
     int mine_exploded;
 
@@ -19,27 +78,63 @@ struct Game {
     // placed more flags than there are mines
     int flags_remaining;
 
-    float cell_size;  // The width/height of each cell in px
+    // Timestamp of when the game started
+    time_t timestamp;
 
-    // The padding between the visible area of cells and the actual border
-    // between cells
-    float cell_padding;
+    // The seed the mines were placed from. The same seed, dimensions and mine
+    // count always give the same board
+    uint64_t seed;
+    struct Rng rng;
 
-    float x_padding;  // The x offset of the grid in px
-    float y_padding;  // The y offset of the grid in px
+    // If the game was loaded from a save file (see savefile.h), the file
+    // mapped into memory, which cells, mines and mine_bits point into.
+    // Otherwise NULL, and those are allocated separately
+    void *mapping;
+    size_t mapping_size;
 
-    // Timestamp of when the game started
-    time_t timestamp;
+    // If the game was initialised by init_game_in_arena(), the arena that
+    // owns all of its memory. Otherwise NULL
+    struct Arena *arena;
 };
 
+// The value that get_cell() returns for each possible byte of a cell
+extern const signed char cell_values[256];
+
+/*
+ * Return the value of a cell from its bits, as get_cell() does. This only
+ * depends on what the player can see
+ */
+static inline int decode_cell(unsigned char cell) {
+    return cell_values[cell];
+}
+
+/*
+ * Return the index into Game.cells of the cell at position (x + y * width)
+ */
+static inline int cell_index(struct Game *game, int position) {
+    return position + position / game->width * 2;
+}
+
 int init_game(struct Game *game, int width, int height, int mine_count,
-              int display_width, int display_height, int grid_padding,
-              float cell_padding);
+              uint64_t seed);
+size_t game_memory_size(int width, int height, int mine_count);
+int init_game_in_arena(struct Game *game, struct Arena *arena, int width,
+                       int height, int mine_count, uint64_t seed);
+int reset_game(struct Game *game, uint64_t seed);
+int reset_game_with_opening(struct Game *game, uint64_t seed, int x, int y);
+void set_grid_size(struct Game *game, int width, int height);
+void free_game(struct Game *game);
 void reveal_neighobouring_cells(struct Game *game, int x, int y);
 void reveal_cell(struct Game *game, int x, int y);
 int won_game(struct Game *game);
 int lost_game(struct Game *game);
 int get_cell(struct Game *game, int x, int y);
+int adjacent_mines(struct Game *game, int x, int y);
 void toggle_flag(struct Game *game, int x, int y);
+void click_cell(struct Game *game, int x, int y, int button);
+uint64_t hash_game(struct Game *game);
+void clear_dirty_cells(struct Game *game);
+int compute_adjacent_counts(struct Game *game);
+const char *adjacent_counts_kernel();
 
 #endif
\ No newline at end of file
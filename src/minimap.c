@@ -0,0 +1,376 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_primitives.h>
+#include <allegro5/allegro_font.h>
+
+#include "minesweeper.h"
+#include "endless.h"
+#include "graphics.h"
+#include "minimap.h"
+#include "error.h"
+
+// The most px the picture can be wide or tall, not counting its frame
+#define MINIMAP_SIZE 160
+
+// The width of the frame around the picture, and the gap between it and the
+// corner of the grid's view, in px
+#define MINIMAP_FRAME 3
+#define MINIMAP_MARGIN 10
+
+// The states a cell can be drawn in
+enum MinimapState {
+    STATE_UNKNOWN,
+    STATE_REVEALED,
+    STATE_FLAGGED,
+    STATE_MINE
+};
+
+// Colours of blocks where every cell is in one state. Other blocks mix them.
+// A block with any mines showing is drawn as a mine
+static const unsigned char unknown_rgb[3] =  {180, 180, 180};
+static const unsigned char revealed_rgb[3] = {240, 240, 240};
+static const unsigned char flagged_rgb[3] =  {230, 120, 0};
+static const unsigned char mine_rgb[3] =     {255, 0, 0};
+
+/*
+ * Return the state that a cell value is drawn in
+ */
+static enum MinimapState get_state(int value) {
+    switch (value) {
+        case CELL_TYPE_UNKNOWN:
+            return STATE_UNKNOWN;
+        case CELL_TYPE_FLAG:
+            return STATE_FLAGGED;
+        case CELL_TYPE_MINE:
+            return STATE_MINE;
+        default:
+            return STATE_REVEALED;
+    }
+}
+
+static enum MinimapState get_cell_state(struct Minimap *minimap, int position) {
+    return (minimap->cell_states[position / 4] >> (2 * (position % 4))) & 3;
+}
+
+static void set_cell_state(struct Minimap *minimap, int position,
+                           enum MinimapState state) {
+    int shift = 2 * (position % 4);
+    unsigned char *byte = &(minimap->cell_states[position / 4]);
+    *byte = (*byte & ~(3 << shift)) | (state << shift);
+}
+
+/*
+ * Return the index of the block that a cell is in
+ */
+static int get_block(struct Minimap *minimap, int position) {
+    int x = position % minimap->board_width;
+    int y = position / minimap->board_width;
+    return (x / minimap->block_size) + (y / minimap->block_size) *
+                                       minimap->width;
+}
+
+/*
+ * Add delta to the count of cells in a block that are in a state. Unknown
+ * cells are whatever is left, so are not counted
+ */
+static void count_state(struct Minimap *minimap, int block,
+                        enum MinimapState state, int delta) {
+    switch (state) {
+        case STATE_REVEALED:
+            minimap->revealed[block] += delta;
+            break;
+        case STATE_FLAGGED:
+            minimap->flagged[block] += delta;
+            break;
+        case STATE_MINE:
+            minimap->mines[block] += delta;
+            break;
+        case STATE_UNKNOWN:
+            break;
+    }
+}
+
+static void mark_block_dirty(struct Minimap *minimap, int block) {
+    if (!minimap->dirty[block]) {
+        minimap->dirty[block] = 1;
+        minimap->dirty_blocks[minimap->dirty_count++] = block;
+    }
+}
+
+/*
+ * Return the colour of a block from the states of its cells
+ */
+static ALLEGRO_COLOR get_block_colour(struct Minimap *minimap, int block) {
+    if (minimap->mines[block] > 0) {
+        return al_map_rgb(mine_rgb[0], mine_rgb[1], mine_rgb[2]);
+    }
+
+    // Blocks on the right and bottom edges may be cut short by the board
+    int bx = (block % minimap->width) * minimap->block_size;
+    int by = (block / minimap->width) * minimap->block_size;
+    int w = minimap->board_width - bx;
+    int h = minimap->board_height - by;
+    int area = (w < minimap->block_size ? w : minimap->block_size) *
+               (h < minimap->block_size ? h : minimap->block_size);
+
+    int revealed = minimap->revealed[block];
+    int flagged = minimap->flagged[block];
+    int unknown = area - revealed - flagged;
+
+    unsigned char rgb[3];
+    for (int i=0; i<3; i++) {
+        rgb[i] = (unknown * unknown_rgb[i] + revealed * revealed_rgb[i] +
+                  flagged * flagged_rgb[i]) / area;
+    }
+    return al_map_rgb(rgb[0], rgb[1], rgb[2]);
+}
+
+/*
+ * Redraw the pixels of the blocks that have changed, and clear the list of
+ * changed blocks
+ */
+static void draw_dirty_blocks(struct Minimap *minimap) {
+    if (minimap->dirty_count == 0) {
+        return;
+    }
+
+    // Only the rectangle around the changed blocks is locked, so a click
+    // only copies a few pixels to and from the GPU
+    int x1 = minimap->width;
+    int y1 = minimap->height;
+    int x2 = 0;
+    int y2 = 0;
+    for (int i=0; i<minimap->dirty_count; i++) {
+        int x = minimap->dirty_blocks[i] % minimap->width;
+        int y = minimap->dirty_blocks[i] / minimap->width;
+        x1 = (x < x1 ? x : x1);
+        y1 = (y < y1 ? y : y1);
+        x2 = (x + 1 > x2 ? x + 1 : x2);
+        y2 = (y + 1 > y2 ? y + 1 : y2);
+    }
+
+    ALLEGRO_STATE state;
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+    al_set_target_bitmap(minimap->bitmap);
+    al_lock_bitmap_region(minimap->bitmap, x1, y1, x2 - x1, y2 - y1,
+                          ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READWRITE);
+
+    for (int i=0; i<minimap->dirty_count; i++) {
+        int block = minimap->dirty_blocks[i];
+        al_put_pixel(block % minimap->width, block / minimap->width,
+                     get_block_colour(minimap, block));
+        minimap->dirty[block] = 0;
+    }
+    minimap->dirty_count = 0;
+
+    al_unlock_bitmap(minimap->bitmap);
+    al_restore_state(&state);
+}
+
+/*
+ * Create the minimap for a game, and place it in the bottom right corner of
+ * the grid's view. This must be called after set_grid_layout(). The minimap
+ * must be zeroed or freed before it is first created, and can then be created
+ * again for each new game, reusing its memory and its bitmap if they are big
+ * enough. Return 1 if successful, 0 otherwise
+ */
+int init_minimap(struct Minimap *minimap, struct Game *game) {
+    int old_width = minimap->width;
+    int old_height = minimap->height;
+    minimap->board_width = game->width;
+    minimap->board_height = game->height;
+
+    int size = (game->width > game->height ? game->width : game->height);
+    minimap->block_size = (size + MINIMAP_SIZE - 1) / MINIMAP_SIZE;
+    minimap->width = (game->width + minimap->block_size - 1) /
+                     minimap->block_size;
+    minimap->height = (game->height + minimap->block_size - 1) /
+                      minimap->block_size;
+
+    int cell_count = game->width * game->height;
+    int block_count = minimap->width * minimap->height;
+    size_t states_size = (cell_count + 3) / 4;
+    size_t counts_size = sizeof(unsigned short) * block_count;
+    if (!reserve_arena(&(minimap->arena), arena_size(states_size) +
+                       3 * arena_size(counts_size) +
+                       arena_size(sizeof(int) * block_count) +
+                       arena_size(block_count))) {
+        free_minimap(minimap);
+        return 0;
+    }
+    minimap->cell_states = arena_alloc(&(minimap->arena), states_size);
+    minimap->revealed = arena_alloc(&(minimap->arena), counts_size);
+    minimap->flagged = arena_alloc(&(minimap->arena), counts_size);
+    minimap->mines = arena_alloc(&(minimap->arena), counts_size);
+    minimap->dirty_blocks = arena_alloc(&(minimap->arena),
+                                        sizeof(int) * block_count);
+    minimap->dirty = arena_alloc(&(minimap->arena), block_count);
+    memset(minimap->cell_states, 0, states_size);
+    memset(minimap->revealed, 0, counts_size);
+    memset(minimap->flagged, 0, counts_size);
+    memset(minimap->mines, 0, counts_size);
+    memset(minimap->dirty, 0, block_count);
+    minimap->dirty_count = 0;
+    minimap->visible = 0;
+
+    // The picture is redrawn in full below, so the last game's bitmap can be
+    // used if it is the same size
+    if (minimap->bitmap != NULL &&
+        (minimap->width != old_width || minimap->height != old_height)) {
+        al_destroy_bitmap(minimap->bitmap);
+        minimap->bitmap = NULL;
+    }
+    if (minimap->bitmap == NULL) {
+        minimap->bitmap = al_create_bitmap(minimap->width, minimap->height);
+    }
+    if (minimap->bitmap == NULL) {
+        print_error("Failed to create the minimap");
+        free_minimap(minimap);
+        return 0;
+    }
+
+    size = (minimap->width > minimap->height ? minimap->width : minimap->height);
+    minimap->scale = MINIMAP_SIZE / size;
+    minimap->x = grid_layout.view_x2 - MINIMAP_MARGIN - MINIMAP_FRAME -
+                 minimap->width * minimap->scale;
+    minimap->y = grid_layout.view_y2 - MINIMAP_MARGIN - MINIMAP_FRAME -
+                 minimap->height * minimap->scale;
+
+    // Count the state of every cell once, then draw every block
+    for (int y=0; y<game->height; y++) {
+        for (int x=0; x<game->width; x++) {
+            int position = x + y * game->width;
+            enum MinimapState state =
+                get_state(decode_cell(game->cells[x + y * game->stride]));
+            set_cell_state(minimap, position, state);
+            count_state(minimap, get_block(minimap, position), state, 1);
+        }
+    }
+    for (int i=0; i<block_count; i++) {
+        mark_block_dirty(minimap, i);
+    }
+    draw_dirty_blocks(minimap);
+
+    return 1;
+}
+
+/*
+ * Free the memory and bitmap used by a minimap
+ */
+void free_minimap(struct Minimap *minimap) {
+    free_arena(&(minimap->arena));
+    if (minimap->bitmap != NULL) {
+        al_destroy_bitmap(minimap->bitmap);
+    }
+    memset(minimap, 0, sizeof(*minimap));
+}
+
+/*
+ * Bring the minimap up to date with the cells of the game that have changed
+ * since the grid was last drawn. This must be called before the game's dirty
+ * cells are cleared by draw_dirty_cells() or draw_game(), and takes time in
+ * proportion to the number of them
+ */
+void update_minimap(struct Minimap *minimap, struct Game *game) {
+    for (int i=0; i<game->dirty_count; i++) {
+        int index = game->dirty_cells[i];
+        int position = index % game->stride + index / game->stride *
+                                              game->width;
+        enum MinimapState old_state = get_cell_state(minimap, position);
+        enum MinimapState new_state = get_state(decode_cell(game->cells[index]));
+        if (old_state == new_state) {
+            continue;
+        }
+
+        int block = get_block(minimap, position);
+        count_state(minimap, block, old_state, -1);
+        count_state(minimap, block, new_state, 1);
+        set_cell_state(minimap, position, new_state);
+        mark_block_dirty(minimap, block);
+    }
+
+    draw_dirty_blocks(minimap);
+}
+
+/*
+ * Get the rectangle of the minimap including its frame (see
+ * get_button_rect())
+ */
+static void get_minimap_rect(struct Minimap *minimap, int *x1, int *y1,
+                             int *x2, int *y2) {
+    *x1 = minimap->x - MINIMAP_FRAME;
+    *y1 = minimap->y - MINIMAP_FRAME;
+    *x2 = minimap->x + minimap->width * minimap->scale + MINIMAP_FRAME;
+    *y2 = minimap->y + minimap->height * minimap->scale + MINIMAP_FRAME;
+}
+
+/*
+ * Draw the minimap, with a rectangle around the part of the board in view,
+ * into the selected layer. If the whole board is in view then there is no
+ * need for the minimap, so it is cleared instead
+ */
+void draw_minimap(struct Minimap *minimap, struct Game *game) {
+    int cx1, cy1, cx2, cy2;
+    get_visible_cells(game, &cx1, &cy1, &cx2, &cy2);
+    if (cx1 == 0 && cy1 == 0 && cx2 == game->width && cy2 == game->height) {
+        clear_minimap(minimap);
+        return;
+    }
+    minimap->visible = 1;
+
+    int x1, y1, x2, y2;
+    get_minimap_rect(minimap, &x1, &y1, &x2, &y2);
+    al_draw_filled_rectangle(x1, y1, x2, y2, al_map_rgb(40, 40, 40));
+    al_draw_scaled_bitmap(minimap->bitmap, 0, 0, minimap->width,
+                          minimap->height, minimap->x, minimap->y,
+                          minimap->width * minimap->scale,
+                          minimap->height * minimap->scale, 0);
+
+    // Outline the cells in view
+    float scale = (float) minimap->scale / minimap->block_size;
+    al_draw_rectangle(minimap->x + cx1 * scale + 0.5,
+                      minimap->y + cy1 * scale + 0.5,
+                      minimap->x + cx2 * scale - 0.5,
+                      minimap->y + cy2 * scale - 0.5,
+                      al_map_rgb(255, 255, 255), 1);
+}
+
+/*
+ * Clear the minimap from the selected layer, if it is showing
+ */
+void clear_minimap(struct Minimap *minimap) {
+    if (minimap->visible) {
+        int x1, y1, x2, y2;
+        get_minimap_rect(minimap, &x1, &y1, &x2, &y2);
+        clear_rect(x1, y1, x2, y2);
+        minimap->visible = 0;
+    }
+}
+
+/*
+ * Work out if the specified point is on the minimap, and if so put the point
+ * of the board it shows, in cells, in the addresses pointed to by x_ptr and
+ * y_ptr. Return 1 if the minimap was clicked, 0 otherwise
+ */
+int get_clicked_minimap(struct Minimap *minimap, int mouse_x, int mouse_y,
+                        float *x_ptr, float *y_ptr) {
+    if (!minimap->visible) {
+        return 0;
+    }
+
+    int x1, y1, x2, y2;
+    get_minimap_rect(minimap, &x1, &y1, &x2, &y2);
+    if (mouse_x < x1 || mouse_x >= x2 || mouse_y < y1 || mouse_y >= y2) {
+        return 0;
+    }
+
+    // Clicks on the frame go to the nearest edge of the board
+    float scale = (float) minimap->block_size / minimap->scale;
+    float x = (mouse_x - minimap->x) * scale;
+    float y = (mouse_y - minimap->y) * scale;
+    *x_ptr = (x < 0 ? 0 : (x > minimap->board_width ? minimap->board_width : x));
+    *y_ptr = (y < 0 ? 0 : (y > minimap->board_height ? minimap->board_height : y));
+    return 1;
+}
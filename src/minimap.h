@@ -0,0 +1,52 @@
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+/*
+ * A small picture of the whole board, shown in a corner of the display when
+ * the camera cannot see all of it. Each pixel is a square block of cells,
+ * coloured by how many of them are revealed, flagged or mines. The picture is
+ * only updated where cells have changed
+ */
+struct Minimap {
+    int board_width;
+    int board_height;
+
+    int block_size;  // The width/height of the block of cells for each pixel
+    int width;       // The width of the picture in blocks
+    int height;      // The height of the picture in blocks
+
+    // The state each cell was last drawn in, packed 4 cells to a byte, and
+    // how many cells of each block are in each state
+    unsigned char *cell_states;
+    unsigned short *revealed;
+    unsigned short *flagged;
+    unsigned short *mines;
+
+    // The blocks that have changed since the picture was last updated
+    int *dirty_blocks;
+    int dirty_count;
+    unsigned char *dirty;
+
+    ALLEGRO_BITMAP *bitmap;
+
+    // Holds the arrays above, so that starting another game reuses them
+    struct Arena arena;
+
+    // The position of the picture on the display, and the size of each block
+    // on it in px
+    int x;
+    int y;
+    int scale;
+
+    int visible;
+};
+
+int init_minimap(struct Minimap *minimap, struct Game *game);
+void free_minimap(struct Minimap *minimap);
+void update_minimap(struct Minimap *minimap, struct Game *game);
+void draw_minimap(struct Minimap *minimap, struct Game *game);
+void clear_minimap(struct Minimap *minimap);
+int get_clicked_minimap(struct Minimap *minimap, int mouse_x, int mouse_y,
+                        float *x_ptr, float *y_ptr);
+
+#endif
@@ -0,0 +1,863 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "minesweeper.h"
+#include "probability.h"
+#include "threadpool.h"
+#include "error.h"
+
+// The largest number of neighbours a cell can have
+#define MAX_NEIGHBOURS 8
+
+// Components with at least this many cells are split across the thread pool
+#define PARALLEL_MIN_CELLS 24
+
+// The most variables that are fixed to split a component into tasks, and the
+// number of tasks to aim for per thread
+#define MAX_SPLIT_DEPTH 12
+#define TASKS_PER_THREAD 8
+
+#define CELL_COUNTS_STRIDE (MAX_COMPONENT_CELLS + 1)
+
+/*
+ * The probability engine works out, for every unknown cell, the fraction of
+ * all mine arrangements consistent with what the player can see in which that
+ * cell holds a mine. Every arrangement is equally likely, since the mines are
+ * placed uniformly at random.
+ *
+ * Unknown cells next to a numbered cell form the frontier. The numbered cells
+ * give constraints on the frontier, which split into independent components.
+ * The arrangements of each component are enumerated, counted by how many mines
+ * they use. The remaining unknown cells (the interior) are unconstrained, so
+ * there are C(interior, m) ways to place m mines there. Combining the
+ * components with these binomial weights, so that the total number of mines
+ * is right, gives the exact probabilities
+ */
+
+/*
+ * The arguments for a task that enumerates part of a component
+ */
+struct EnumerationTask {
+    struct ProbabilityEngine *engine;
+    int component;
+    int depth;  // The number of variables fixed by each prefix
+    int mines_left;
+};
+
+/*
+ * Allocate the scratch space for one thread. Return 1 if successful, 0
+ * otherwise
+ */
+static int init_scratch(struct EnumerationScratch *scratch, int cell_count) {
+    scratch->constraint_mines = malloc(sizeof(int) * cell_count);
+    scratch->constraint_unassigned = malloc(sizeof(int) * cell_count);
+    scratch->cell_counts = malloc(sizeof(double) * MAX_COMPONENT_CELLS *
+                                  CELL_COUNTS_STRIDE);
+
+    return scratch->constraint_mines != NULL &&
+           scratch->constraint_unassigned != NULL &&
+           scratch->cell_counts != NULL;
+}
+
+/*
+ * Allocate scratch space for boards of up to cell_count cells. If pool is not
+ * NULL then large components are split across its threads. Return 1 if
+ * successful, 0 otherwise
+ */
+int init_probability_engine(struct ProbabilityEngine *engine, int cell_count,
+                            struct ThreadPool *pool) {
+    memset(engine, 0, sizeof(*engine));
+    engine->capacity = cell_count;
+    engine->pool = pool;
+    engine->scratch_count = (pool != NULL ? pool->thread_count : 1);
+    engine->log_binomials_n = -1;
+
+    int ok = 1;
+    engine->scratch = calloc(engine->scratch_count,
+                             sizeof(struct EnumerationScratch));
+    if (engine->scratch == NULL) {
+        ok = 0;
+    }
+    for (int i=0; ok && i<engine->scratch_count; i++) {
+        ok = init_scratch(&(engine->scratch[i]), cell_count);
+    }
+
+    engine->var_cells = malloc(sizeof(int) * cell_count);
+    engine->cell_vars = malloc(sizeof(int) * cell_count);
+    engine->parents = malloc(sizeof(int) * cell_count);
+    engine->constraint_vars = malloc(sizeof(int) * cell_count * MAX_NEIGHBOURS);
+    engine->constraint_sizes = malloc(cell_count);
+    engine->constraint_targets = malloc(sizeof(int) * cell_count);
+    engine->var_constraints = malloc(sizeof(int) * cell_count * MAX_NEIGHBOURS);
+    engine->var_constraint_counts = malloc(cell_count);
+    engine->order = malloc(sizeof(int) * cell_count);
+    engine->component_starts = malloc(sizeof(int) * (cell_count + 1));
+    engine->component_constraints = malloc(sizeof(int) * cell_count);
+    engine->component_constraint_starts = malloc(sizeof(int) * (cell_count + 1));
+    engine->cell_count_starts = malloc(sizeof(int) * (cell_count + 1));
+    engine->stamps = calloc(cell_count, sizeof(int));
+    engine->constraint_stamps = calloc(cell_count, sizeof(int));
+    engine->counts = malloc(sizeof(double) * 2 * (cell_count + 1));
+    engine->log_binomials = malloc(sizeof(double) * (cell_count + 1));
+    engine->weights = malloc(sizeof(double) * (cell_count + 1));
+    engine->convolution = malloc(sizeof(double) * (cell_count + 1));
+    engine->suffix = malloc(sizeof(double) * (cell_count + 1));
+    engine->suffix_next = malloc(sizeof(double) * (cell_count + 1));
+    engine->prefix_starts = malloc(sizeof(int) * (cell_count + 2));
+    engine->prefix_assignments = malloc(sizeof(int) << MAX_SPLIT_DEPTH);
+    engine->prefix_mines = malloc(sizeof(int) << MAX_SPLIT_DEPTH);
+
+    if (!ok || engine->var_cells == NULL || engine->cell_vars == NULL ||
+        engine->parents == NULL ||
+        engine->constraint_vars == NULL || engine->constraint_sizes == NULL ||
+        engine->constraint_targets == NULL || engine->var_constraints == NULL ||
+        engine->var_constraint_counts == NULL || engine->order == NULL ||
+        engine->component_starts == NULL ||
+        engine->component_constraints == NULL ||
+        engine->component_constraint_starts == NULL ||
+        engine->cell_count_starts == NULL || engine->stamps == NULL ||
+        engine->constraint_stamps == NULL || engine->counts == NULL ||
+        engine->log_binomials == NULL || engine->weights == NULL ||
+        engine->convolution == NULL || engine->suffix == NULL ||
+        engine->suffix_next == NULL || engine->prefix_starts == NULL ||
+        engine->prefix_assignments == NULL || engine->prefix_mines == NULL) {
+        print_error("Failed to allocate memory for the probability engine");
+        free_probability_engine(engine);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Free the scratch space allocated by init_probability_engine()
+ */
+void free_probability_engine(struct ProbabilityEngine *engine) {
+    for (int i=0; engine->scratch != NULL && i<engine->scratch_count; i++) {
+        free(engine->scratch[i].constraint_mines);
+        free(engine->scratch[i].constraint_unassigned);
+        free(engine->scratch[i].cell_counts);
+    }
+    free(engine->scratch);
+    free(engine->var_cells);
+    free(engine->cell_vars);
+    free(engine->parents);
+    free(engine->constraint_vars);
+    free(engine->constraint_sizes);
+    free(engine->constraint_targets);
+    free(engine->var_constraints);
+    free(engine->var_constraint_counts);
+    free(engine->order);
+    free(engine->component_starts);
+    free(engine->component_constraints);
+    free(engine->component_constraint_starts);
+    free(engine->cell_count_starts);
+    free(engine->stamps);
+    free(engine->constraint_stamps);
+    free(engine->counts);
+    free(engine->cell_counts);
+    free(engine->log_binomials);
+    free(engine->weights);
+    free(engine->convolution);
+    free(engine->suffix);
+    free(engine->suffix_next);
+    free(engine->prefixes);
+    free(engine->prefix_starts);
+    free(engine->prefix_assignments);
+    free(engine->prefix_mines);
+    memset(engine, 0, sizeof(*engine));
+}
+
+/*
+ * Make sure that the buffer pointed to by buffer_ptr has room for at least
+ * size doubles, growing it if not. Return 1 if successful, 0 otherwise
+ */
+static int reserve(double **buffer_ptr, int *capacity_ptr, long size) {
+    if (size <= *capacity_ptr) {
+        return 1;
+    }
+
+    double *buffer = realloc(*buffer_ptr, sizeof(double) * size);
+    if (buffer == NULL) {
+        print_error("Failed to allocate memory for the probability engine");
+        return 0;
+    }
+
+    *buffer_ptr = buffer;
+    *capacity_ptr = size;
+    return 1;
+}
+
+/*
+ * Return the representative of the set containing var, compressing the path
+ * to it
+ */
+static int find_root(struct ProbabilityEngine *engine, int var) {
+    while (engine->parents[var] != var) {
+        engine->parents[var] = engine->parents[engine->parents[var]];
+        var = engine->parents[var];
+    }
+    return var;
+}
+
+/*
+ * Return the frontier variable for the cell at position, creating it if it
+ * does not exist yet
+ */
+static int get_var(struct ProbabilityEngine *engine, int position) {
+    if (engine->cell_vars[position] < 0) {
+        int var = engine->var_count++;
+        engine->cell_vars[position] = var;
+        engine->var_cells[var] = position;
+        engine->parents[var] = var;
+        engine->var_constraint_counts[var] = 0;
+    }
+    return engine->cell_vars[position];
+}
+
+/*
+ * Build a constraint for every numbered cell with unknown neighbours, and the
+ * frontier variables they refer to. Return 0 if a constraint can never be
+ * satisfied (e.g. because of a misplaced flag), 1 otherwise
+ */
+static int build_constraints(struct ProbabilityEngine *engine,
+                             struct Game *game) {
+    int cell_count = game->width * game->height;
+    engine->var_count = 0;
+    engine->constraint_count = 0;
+    for (int i=0; i<cell_count; i++) {
+        engine->cell_vars[i] = -1;
+    }
+
+    for (int y=0; y<game->height; y++) {
+        for (int x=0; x<game->width; x++) {
+            int value = get_cell(game, x, y);
+            if (value <= 0) {
+                continue;
+            }
+
+            int constraint = engine->constraint_count;
+            int *vars = engine->constraint_vars + constraint * MAX_NEIGHBOURS;
+            int size = 0;
+            int target = value;
+
+            for (int ny=y - 1; ny<=y + 1; ny++) {
+                for (int nx=x - 1; nx<=x + 1; nx++) {
+                    if (nx < 0 || nx >= game->width || ny < 0 ||
+                        ny >= game->height || (nx == x && ny == y)) {
+                        continue;
+                    }
+
+                    int neighbour = get_cell(game, nx, ny);
+                    if (neighbour == CELL_TYPE_FLAG) {
+                        target--;
+                    }
+                    else if (neighbour == CELL_TYPE_UNKNOWN) {
+                        vars[size++] = get_var(engine, nx + ny * game->width);
+                    }
+                }
+            }
+
+            if (target < 0 || target > size) {
+                return 0;
+            }
+            if (size == 0) {
+                continue;
+            }
+
+            engine->constraint_sizes[constraint] = size;
+            engine->constraint_targets[constraint] = target;
+            for (int i=0; i<size; i++) {
+                int var = vars[i];
+                int count = engine->var_constraint_counts[var]++;
+                engine->var_constraints[var * MAX_NEIGHBOURS + count] = constraint;
+            }
+            engine->constraint_count++;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Split the frontier into independent components: two variables are in the
+ * same component if they share a constraint. Within each component the
+ * variables are ordered breadth first through the constraints, so that
+ * constraints are completed (and can prune the search) as early as possible
+ */
+static void build_components(struct ProbabilityEngine *engine) {
+    // Join the variables of each constraint
+    for (int c=0; c<engine->constraint_count; c++) {
+        int *vars = engine->constraint_vars + c * MAX_NEIGHBOURS;
+        int root = find_root(engine, vars[0]);
+        for (int i=1; i<engine->constraint_sizes[c]; i++) {
+            int other = find_root(engine, vars[i]);
+            if (other != root) {
+                engine->parents[other] = root;
+            }
+        }
+    }
+
+    // Number the components in order of their first variable, and walk each
+    // one breadth first from that variable
+    engine->component_count = 0;
+    engine->stamp++;
+    int order_size = 0;
+    int constraint_size = 0;
+
+    for (int v=0; v<engine->var_count; v++) {
+        if (engine->stamps[v] == engine->stamp) {
+            continue;
+        }
+
+        int component = engine->component_count++;
+        engine->component_starts[component] = order_size;
+        engine->component_constraint_starts[component] = constraint_size;
+
+        int head = order_size;
+        engine->stamps[v] = engine->stamp;
+        engine->order[order_size++] = v;
+
+        while (head < order_size) {
+            int var = engine->order[head++];
+
+            for (int i=0; i<engine->var_constraint_counts[var]; i++) {
+                int c = engine->var_constraints[var * MAX_NEIGHBOURS + i];
+                if (engine->constraint_stamps[c] == engine->stamp) {
+                    continue;
+                }
+                engine->constraint_stamps[c] = engine->stamp;
+                engine->component_constraints[constraint_size++] = c;
+
+                int *vars = engine->constraint_vars + c * MAX_NEIGHBOURS;
+                for (int j=0; j<engine->constraint_sizes[c]; j++) {
+                    if (engine->stamps[vars[j]] != engine->stamp) {
+                        engine->stamps[vars[j]] = engine->stamp;
+                        engine->order[order_size++] = vars[j];
+                    }
+                }
+            }
+        }
+    }
+
+    engine->component_starts[engine->component_count] = order_size;
+    engine->component_constraint_starts[engine->component_count] =
+        constraint_size;
+}
+
+/*
+ * Get a thread's scratch space ready to enumerate a component: clear the
+ * constraint state and the counts
+ */
+static void reset_scratch(struct ProbabilityEngine *engine,
+                          struct EnumerationScratch *scratch, int component) {
+    for (int i=engine->component_constraint_starts[component];
+         i<engine->component_constraint_starts[component + 1]; i++) {
+        int c = engine->component_constraints[i];
+        scratch->constraint_mines[c] = 0;
+        scratch->constraint_unassigned[c] = engine->constraint_sizes[c];
+    }
+}
+
+static void clear_counts(struct EnumerationScratch *scratch, int size) {
+    scratch->nodes = 0;
+    memset(scratch->counts, 0, sizeof(double) * (size + 1));
+    for (int i=0; i<size; i++) {
+        memset(scratch->cell_counts + i * CELL_COUNTS_STRIDE, 0,
+               sizeof(double) * (size + 1));
+    }
+}
+
+/*
+ * Assign a value (1 for a mine) to a variable and update its constraints.
+ * Return 1 if every constraint can still be satisfied, 0 otherwise. The
+ * assignment must be undone with unassign_var() either way
+ */
+static int assign_var(struct ProbabilityEngine *engine,
+                      struct EnumerationScratch *scratch, int var, int value) {
+    int ok = 1;
+    for (int i=0; i<engine->var_constraint_counts[var]; i++) {
+        int c = engine->var_constraints[var * MAX_NEIGHBOURS + i];
+        int mines = (scratch->constraint_mines[c] += value);
+        int unassigned = --scratch->constraint_unassigned[c];
+        int target = engine->constraint_targets[c];
+        if (mines > target || mines + unassigned < target) {
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+static void unassign_var(struct ProbabilityEngine *engine,
+                         struct EnumerationScratch *scratch, int var,
+                         int value) {
+    for (int i=0; i<engine->var_constraint_counts[var]; i++) {
+        int c = engine->var_constraints[var * MAX_NEIGHBOURS + i];
+        scratch->constraint_mines[c] -= value;
+        scratch->constraint_unassigned[c]++;
+    }
+}
+
+/*
+ * Enumerate every consistent assignment of the variables of a component from
+ * depth onwards, given that mines mines have been placed in the earlier ones.
+ * If stop_depth is less than the size of the component, then record the
+ * assignments of the first stop_depth variables as prefixes instead of
+ * counting complete arrangements. This gives up once the scratch has tried
+ * MAX_ENUMERATION_NODES assignments, leaving the counts incomplete
+ */
+static void enumerate(struct ProbabilityEngine *engine,
+                      struct EnumerationScratch *scratch, int component,
+                      int depth, int mines, int mines_left, int stop_depth) {
+    if (++scratch->nodes > MAX_ENUMERATION_NODES) {
+        return;
+    }
+
+    int start = engine->component_starts[component];
+    int size = engine->component_starts[component + 1] - start;
+
+    if (depth == stop_depth && stop_depth < size) {
+        int prefix = 0;
+        for (int i=0; i<depth; i++) {
+            prefix |= scratch->assignment[i] << i;
+        }
+        engine->prefix_assignments[engine->prefix_count] = prefix;
+        engine->prefix_mines[engine->prefix_count] = mines;
+        engine->prefix_count++;
+        return;
+    }
+
+    if (depth == size) {
+        scratch->counts[mines] += 1;
+        for (int i=0; i<size; i++) {
+            if (scratch->assignment[i]) {
+                scratch->cell_counts[i * CELL_COUNTS_STRIDE + mines] += 1;
+            }
+        }
+        return;
+    }
+
+    int var = engine->order[start + depth];
+    for (int value=0; value<=1; value++) {
+        if (mines + value > mines_left) {
+            break;
+        }
+        if (assign_var(engine, scratch, var, value)) {
+            scratch->assignment[depth] = value;
+            enumerate(engine, scratch, component, depth + 1, mines + value,
+                      mines_left, stop_depth);
+        }
+        unassign_var(engine, scratch, var, value);
+    }
+}
+
+/*
+ * Thread pool task: enumerate every arrangement of a component that starts
+ * with one of the prefixes
+ */
+static void enumeration_task(void *context, int index, int worker) {
+    struct EnumerationTask *task = context;
+    struct ProbabilityEngine *engine = task->engine;
+    struct EnumerationScratch *scratch = &(engine->scratch[worker]);
+    int start = engine->component_starts[task->component];
+
+    reset_scratch(engine, scratch, task->component);
+    int prefix = engine->prefix_assignments[index];
+    for (int i=0; i<task->depth; i++) {
+        int value = (prefix >> i) & 1;
+        assign_var(engine, scratch, engine->order[start + i], value);
+        scratch->assignment[i] = value;
+    }
+
+    enumerate(engine, scratch, task->component, task->depth,
+              engine->prefix_mines[index], task->mines_left, -1);
+}
+
+/*
+ * Estimate the counts of a component that is too tangled to enumerate, from
+ * each of its cells' constraints alone. A cell is safe if any of its
+ * constraints has no mines left and a mine if any has no safe cells left,
+ * and otherwise has the average density of its constraints. The component is
+ * then treated as holding the nearest whole number to the expected count of
+ * mines, with each cell a mine in that fraction of its arrangements
+ */
+static void estimate_component(struct ProbabilityEngine *engine,
+                               int component, int mines_left, double *counts,
+                               double *cell_counts) {
+    int start = engine->component_starts[component];
+    int size = engine->component_starts[component + 1] - start;
+
+    double expected = 0;
+    for (int i=0; i<size; i++) {
+        int var = engine->order[start + i];
+        double density = 0;
+        int safe = 0;
+        int mine = 0;
+        for (int j=0; j<engine->var_constraint_counts[var]; j++) {
+            int c = engine->var_constraints[var * MAX_NEIGHBOURS + j];
+            int target = engine->constraint_targets[c];
+            safe |= (target == 0);
+            mine |= (target == engine->constraint_sizes[c]);
+            density += (double) target / engine->constraint_sizes[c];
+        }
+        density /= engine->var_constraint_counts[var];
+
+        // Keep the probability in the count for 0 mines until the number of
+        // mines is known
+        cell_counts[i * (size + 1)] = (safe ? 0 : mine ? 1 : density);
+        expected += cell_counts[i * (size + 1)];
+    }
+
+    int mines = (int) (expected + 0.5);
+    if (mines > mines_left) {
+        mines = mines_left;
+    }
+    counts[mines] = 1;
+    for (int i=0; i<size; i++) {
+        double probability = cell_counts[i * (size + 1)];
+        cell_counts[i * (size + 1)] = 0;
+        cell_counts[i * (size + 1) + mines] = probability;
+    }
+}
+
+/*
+ * Enumerate the arrangements of a component and store the counts in the
+ * engine's results. Large components are split into tasks by fixing their
+ * first few variables, and the tasks are run on the thread pool with a
+ * separate set of counts per thread, which are added up afterwards
+ */
+static void enumerate_component(struct ProbabilityEngine *engine,
+                                int component, int mines_left) {
+    int size = engine->component_starts[component + 1] -
+               engine->component_starts[component];
+    int threads = engine->scratch_count;
+
+    if (size < PARALLEL_MIN_CELLS || threads == 1) {
+        struct EnumerationScratch *scratch = &(engine->scratch[0]);
+        reset_scratch(engine, scratch, component);
+        clear_counts(scratch, size);
+        enumerate(engine, scratch, component, 0, 0, mines_left, -1);
+        threads = 1;
+    }
+    else {
+        int depth = 1;
+        while ((1 << depth) < TASKS_PER_THREAD * threads &&
+               depth < MAX_SPLIT_DEPTH && depth < size - 1) {
+            depth++;
+        }
+
+        engine->prefix_count = 0;
+        engine->scratch[0].nodes = 0;
+        reset_scratch(engine, &(engine->scratch[0]), component);
+        enumerate(engine, &(engine->scratch[0]), component, 0, 0, mines_left,
+                  depth);
+
+        for (int i=0; i<threads; i++) {
+            clear_counts(&(engine->scratch[i]), size);
+        }
+
+        struct EnumerationTask task;
+        task.engine = engine;
+        task.component = component;
+        task.depth = depth;
+        task.mines_left = mines_left;
+        thread_pool_run(engine->pool, engine->prefix_count, enumeration_task,
+                        &task);
+    }
+
+    // Add up the counts from each thread
+    double *counts = engine->counts + engine->component_starts[component] +
+                     component;
+    double *cell_counts = engine->cell_counts +
+                          engine->cell_count_starts[component];
+    memset(counts, 0, sizeof(double) * (size + 1));
+    memset(cell_counts, 0, sizeof(double) * size * (size + 1));
+
+    for (int t=0; t<threads; t++) {
+        if (engine->scratch[t].nodes > MAX_ENUMERATION_NODES) {
+            estimate_component(engine, component, mines_left, counts,
+                               cell_counts);
+            return;
+        }
+    }
+
+    for (int t=0; t<threads; t++) {
+        struct EnumerationScratch *scratch = &(engine->scratch[t]);
+        for (int k=0; k<=size; k++) {
+            counts[k] += scratch->counts[k];
+        }
+        for (int i=0; i<size; i++) {
+            for (int k=0; k<=size; k++) {
+                cell_counts[i * (size + 1) + k] +=
+                    scratch->cell_counts[i * CELL_COUNTS_STRIDE + k];
+            }
+        }
+    }
+
+    // Only the ratios between counts matter, so scale them to stop the
+    // products of counts from many components overflowing
+    double max = 0;
+    for (int k=0; k<=size; k++) {
+        if (counts[k] > max) {
+            max = counts[k];
+        }
+    }
+    if (max > 0) {
+        for (int k=0; k<=size; k++) {
+            counts[k] /= max;
+        }
+        for (int i=0; i<size * (size + 1); i++) {
+            cell_counts[i] /= max;
+        }
+    }
+}
+
+/*
+ * Store the convolution of a (length a_size) and b (length b_size) in result,
+ * scaled so that its largest element is 1, and return its length
+ */
+static int convolve(double *a, int a_size, double *b, int b_size,
+                    double *result) {
+    int size = a_size + b_size - 1;
+    double max = 0;
+
+    for (int k=0; k<size; k++) {
+        double sum = 0;
+        int i_min = (k - b_size + 1 > 0 ? k - b_size + 1 : 0);
+        int i_max = (k < a_size - 1 ? k : a_size - 1);
+        for (int i=i_min; i<=i_max; i++) {
+            sum += a[i] * b[k - i];
+        }
+        result[k] = sum;
+        if (sum > max) {
+            max = sum;
+        }
+    }
+
+    if (max > 0) {
+        for (int k=0; k<size; k++) {
+            result[k] /= max;
+        }
+    }
+
+    return size;
+}
+
+/*
+ * Fill in engine->weights so that weights[j] is proportional to the number of
+ * ways of placing j mines in the interior cells, C(interior, j), for
+ * j in [0, mines_left]. The log binomials are kept between calls and only
+ * recomputed when the number of interior cells changes. Return 0 if there is
+ * no valid number of interior mines, 1 otherwise
+ */
+static int compute_weights(struct ProbabilityEngine *engine, int interior,
+                           int mines_left) {
+    if (engine->log_binomials_n != interior) {
+        double log_n = lgamma(interior + 1.0);
+        for (int j=0; j<=interior; j++) {
+            engine->log_binomials[j] = log_n - lgamma(j + 1.0) -
+                                       lgamma(interior - j + 1.0);
+        }
+        engine->log_binomials_n = interior;
+    }
+
+    // The frontier holds between 0 and var_count mines
+    int j_min = mines_left - engine->var_count;
+    if (j_min < 0) {
+        j_min = 0;
+    }
+    int j_max = (mines_left < interior ? mines_left : interior);
+    if (j_min > j_max) {
+        return 0;
+    }
+
+    double max = engine->log_binomials[j_min];
+    for (int j=j_min; j<=j_max; j++) {
+        if (engine->log_binomials[j] > max) {
+            max = engine->log_binomials[j];
+        }
+    }
+
+    for (int j=0; j<=mines_left; j++) {
+        if (j <= interior) {
+            engine->weights[j] = exp(engine->log_binomials[j] - max);
+        }
+        else {
+            engine->weights[j] = 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Return the weight of the interior holding the mines that are left after
+ * frontier_mines have been placed on the frontier
+ */
+static double interior_weight(struct ProbabilityEngine *engine,
+                              int frontier_mines, int mines_left) {
+    int j = mines_left - frontier_mines;
+    return (j >= 0 ? engine->weights[j] : 0);
+}
+
+/*
+ * Work out the probability that each cell of the game contains a mine, from
+ * the player-visible state only, and store them in probabilities (one per
+ * cell, indexed by x + y * width). Revealed cells get 0, and flagged cells 1,
+ * since flags are assumed to be correct. Components with more arrangements
+ * than can be enumerated in MAX_ENUMERATION_NODES steps only get an estimate
+ * (see estimate_component()). Return 1 if successful, or 0 if the visible
+ * state is inconsistent or a component is too large to enumerate
+ */
+int compute_probabilities(struct ProbabilityEngine *engine, struct Game *game,
+                          double *probabilities) {
+    int cell_count = game->width * game->height;
+    int mines_left = game->flags_remaining;
+    if (cell_count > engine->capacity || mines_left < 0) {
+        return 0;
+    }
+
+    if (!build_constraints(engine, game)) {
+        return 0;
+    }
+    build_components(engine);
+
+    // Work out where each component's results go, and make room for them
+    long results_size = 0;
+    for (int c=0; c<engine->component_count; c++) {
+        int size = engine->component_starts[c + 1] - engine->component_starts[c];
+        if (size > MAX_COMPONENT_CELLS) {
+            return 0;
+        }
+        engine->cell_count_starts[c] = results_size;
+        results_size += size * (size + 1);
+    }
+    long prefixes_size = (long) (engine->component_count + 1) *
+                         (engine->var_count + 1);
+    if (!reserve(&(engine->cell_counts), &(engine->cell_counts_capacity),
+                 results_size) ||
+        !reserve(&(engine->prefixes), &(engine->prefixes_capacity),
+                 prefixes_size)) {
+        return 0;
+    }
+
+    int interior = 0;
+    for (int y=0; y<game->height; y++) {
+        for (int x=0; x<game->width; x++) {
+            if (get_cell(game, x, y) == CELL_TYPE_UNKNOWN &&
+                engine->cell_vars[x + y * game->width] < 0) {
+                interior++;
+            }
+        }
+    }
+
+    for (int c=0; c<engine->component_count; c++) {
+        enumerate_component(engine, c, mines_left);
+    }
+
+    if (!compute_weights(engine, interior, mines_left)) {
+        return 0;
+    }
+
+    // prefixes[c] is the distribution of the number of mines in components
+    // 0 to c - 1
+    int size = 1;
+    engine->prefix_starts[0] = 0;
+    engine->prefixes[0] = 1;
+    for (int c=0; c<engine->component_count; c++) {
+        int component_size = engine->component_starts[c + 1] -
+                             engine->component_starts[c];
+        double *counts = engine->counts + engine->component_starts[c] + c;
+        double *prefix = engine->prefixes + engine->prefix_starts[c];
+        engine->prefix_starts[c + 1] = engine->prefix_starts[c] + size;
+        size = convolve(prefix, size, counts, component_size + 1,
+                        engine->prefixes + engine->prefix_starts[c + 1]);
+    }
+
+    // Weight each total number of frontier mines by the number of ways of
+    // placing the rest in the interior
+    double *frontier = engine->prefixes +
+                       engine->prefix_starts[engine->component_count];
+    double total = 0;
+    double interior_mines = 0;
+    for (int k=0; k<size && k<=mines_left; k++) {
+        double weight = frontier[k] * interior_weight(engine, k, mines_left);
+        total += weight;
+        interior_mines += weight * (mines_left - k);
+    }
+    if (total <= 0) {
+        return 0;
+    }
+    double interior_probability = (interior > 0 ?
+                                   interior_mines / total / interior : 0);
+
+    // For each component, combine the other components (the prefix before it
+    // and the suffix after it) and weight each of its own mine counts by the
+    // number of ways of completing the board
+    double *suffix = engine->suffix;
+    double *suffix_next = engine->suffix_next;
+    int suffix_size = 1;
+    suffix[0] = 1;
+
+    for (int c=engine->component_count - 1; c>=0; c--) {
+        int start = engine->component_starts[c];
+        int component_size = engine->component_starts[c + 1] - start;
+        double *counts = engine->counts + start + c;
+        double *cell_counts = engine->cell_counts + engine->cell_count_starts[c];
+        double *prefix = engine->prefixes + engine->prefix_starts[c];
+        int prefix_size = engine->prefix_starts[c + 1] - engine->prefix_starts[c];
+
+        int others_size = convolve(prefix, prefix_size, suffix, suffix_size,
+                                   engine->convolution);
+
+        // completions[k] is the weight of the rest of the board when this
+        // component has k mines. This reuses suffix_next, which is not needed
+        // until after these have been used
+        double *completions = suffix_next;
+        double component_total = 0;
+        for (int k=0; k<=component_size; k++) {
+            completions[k] = 0;
+            for (int r=0; r<others_size && k + r<=mines_left; r++) {
+                completions[k] += engine->convolution[r] *
+                                  interior_weight(engine, k + r, mines_left);
+            }
+            component_total += counts[k] * completions[k];
+        }
+
+        for (int i=0; i<component_size; i++) {
+            double mine_total = 0;
+            for (int k=0; k<=component_size; k++) {
+                mine_total += cell_counts[i * (component_size + 1) + k] *
+                              completions[k];
+            }
+            int position = engine->var_cells[engine->order[start + i]];
+            probabilities[position] = (component_total > 0 ?
+                                       mine_total / component_total : 0);
+        }
+
+        suffix_size = convolve(suffix, suffix_size, counts, component_size + 1,
+                               suffix_next);
+        double *swap = suffix;
+        suffix = suffix_next;
+        suffix_next = swap;
+    }
+
+    for (int y=0; y<game->height; y++) {
+        for (int x=0; x<game->width; x++) {
+            int position = x + y * game->width;
+            int value = get_cell(game, x, y);
+            if (value == CELL_TYPE_FLAG) {
+                probabilities[position] = 1;
+            }
+            else if (value != CELL_TYPE_UNKNOWN) {
+                probabilities[position] = 0;
+            }
+            else if (engine->cell_vars[position] < 0) {
+                probabilities[position] = interior_probability;
+            }
+        }
+    }
+
+    return 1;
+}
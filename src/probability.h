@@ -0,0 +1,112 @@
+#ifndef PROBABILITY_H
+#define PROBABILITY_H
+
+#include "minesweeper.h"
+#include "threadpool.h"
+
+// The largest connected group of frontier cells that will be enumerated
+#define MAX_COMPONENT_CELLS 128
+
+// The most assignments each thread tries while enumerating a component. A
+// component that needs more is estimated from its constraints instead, as
+// tangled components can have far too many arrangements to count
+#define MAX_ENUMERATION_NODES (1L << 21)
+
+/*
+ * Per-thread scratch space used while enumerating the mine arrangements of a
+ * component
+ */
+struct EnumerationScratch {
+    // For each constraint, the mines placed so far in its cells and the number
+    // of its cells that have not been assigned yet
+    int *constraint_mines;
+    int *constraint_unassigned;
+
+    unsigned char assignment[MAX_COMPONENT_CELLS];
+
+    // counts[k] is the number of arrangements with k mines, and
+    // cell_counts[i * (MAX_COMPONENT_CELLS + 1) + k] the number of those in
+    // which cell i of the component is a mine
+    double counts[MAX_COMPONENT_CELLS + 1];
+    double *cell_counts;
+
+    long nodes;  // The assignments tried, up to MAX_ENUMERATION_NODES
+};
+
+/*
+ * Scratch space and results for compute_probabilities(). This is sized for
+ * the largest board it will be used on, so it can be reused without
+ * allocating
+ */
+struct ProbabilityEngine {
+    int capacity;  // The number of cells the scratch arrays have room for
+
+    // Used to split large components across threads. This can be NULL, in
+    // which case everything runs on the calling thread
+    struct ThreadPool *pool;
+    int scratch_count;
+    struct EnumerationScratch *scratch;
+
+    // The frontier: unknown cells next to at least one numbered cell. These
+    // are the variables of the constraints. cell_vars maps a cell position to
+    // its variable, or -1 if it is not on the frontier
+    int var_count;
+    int *var_cells;
+    int *cell_vars;
+    int *parents;
+
+    // One constraint per numbered cell with unknown neighbours: the number of
+    // mines among its variables
+    int constraint_count;
+    int *constraint_vars;
+    unsigned char *constraint_sizes;
+    int *constraint_targets;
+    int *var_constraints;
+    unsigned char *var_constraint_counts;
+
+    // Variables grouped by component, in the order they are enumerated, and
+    // the constraints of each component. Component i has the variables
+    // order[component_starts[i]] to order[component_starts[i + 1] - 1]
+    int component_count;
+    int *order;
+    int *component_starts;
+    int *component_constraints;
+    int *component_constraint_starts;
+    int *stamps;
+    int *constraint_stamps;
+    int stamp;
+
+    // The enumeration results for every component. Component i's counts start
+    // at counts[component_starts[i] + i] and its cell counts at
+    // cell_counts[cell_count_starts[i]]. cell_counts grows as needed
+    double *counts;
+    double *cell_counts;
+    int cell_counts_capacity;
+    int *cell_count_starts;
+
+    // Buffers for combining the components. log_binomials holds
+    // ln C(log_binomials_n, j), and is kept while the interior size is the same
+    double *log_binomials;
+    int log_binomials_n;
+    double *weights;
+    double *convolution;
+    double *suffix;
+    double *suffix_next;
+    double *prefixes;
+    int prefixes_capacity;
+    int *prefix_starts;
+
+    // Assignments of the first few variables of a large component, used as
+    // separate tasks for the thread pool
+    int *prefix_assignments;
+    int *prefix_mines;
+    int prefix_count;
+};
+
+int init_probability_engine(struct ProbabilityEngine *engine, int cell_count,
+                            struct ThreadPool *pool);
+void free_probability_engine(struct ProbabilityEngine *engine);
+int compute_probabilities(struct ProbabilityEngine *engine, struct Game *game,
+                          double *probabilities);
+
+#endif
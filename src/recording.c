@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "minesweeper.h"
+#include "recording.h"
+#include "error.h"
+
+// The size of the header at the start of a recording
+#define RECORDING_HEADER_SIZE (sizeof(RECORDING_MAGIC) + 4)
+
+/*
+ * Write the lowest size bytes of value to the recording, least significant
+ * first
+ */
+static void put_bytes(struct Recorder *recorder, uint64_t value, int size) {
+    for (int i=0; i<size; i++) {
+        fputc((value >> (8 * i)) & 0xff, recorder->file);
+    }
+}
+
+/*
+ * Read a size-byte little-endian integer from data
+ */
+static uint64_t get_bytes(const unsigned char *data, int size) {
+    uint64_t value = 0;
+    for (int i=0; i<size; i++) {
+        value |= (uint64_t) data[i] << (8 * i);
+    }
+    return value;
+}
+
+/*
+ * Start a record of type, stamped with the time since recording began
+ */
+static void put_record_start(struct Recorder *recorder, int type) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - recorder->start.tv_sec) * 1000 +
+                      (now.tv_nsec - recorder->start.tv_nsec) / 1000000;
+
+    put_bytes(recorder, type, 1);
+    put_bytes(recorder, elapsed_ms, 4);
+}
+
+/*
+ * Stop recording if anything written so far has failed
+ */
+static void check_recorder(struct Recorder *recorder) {
+    if (ferror(recorder->file)) {
+        print_error("Failed to write the recording, so it has been stopped");
+        fclose(recorder->file);
+        recorder->file = NULL;
+    }
+}
+
+/*
+ * Start recording to a new file at path. Return 1 if successful, 0 otherwise
+ */
+int open_recorder(struct Recorder *recorder, const char *path) {
+    recorder->in_game = 0;
+    recorder->file = fopen(path, "wb");
+    if (recorder->file == NULL) {
+        print_error("Failed to create %s", path);
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &(recorder->start));
+    fwrite(RECORDING_MAGIC, sizeof(RECORDING_MAGIC), 1, recorder->file);
+    put_bytes(recorder, RECORDING_VERSION, 4);
+    check_recorder(recorder);
+    return (recorder->file != NULL);
+}
+
+/*
+ * Finish the recording, if there is one
+ */
+void close_recorder(struct Recorder *recorder) {
+    if (recorder->file != NULL) {
+        fclose(recorder->file);
+        recorder->file = NULL;
+    }
+}
+
+/*
+ * Record that a game has just been started, with the cell at opening_x,
+ * opening_y already revealed, or no cell if they are -1
+ */
+void record_game_start(struct Recorder *recorder, struct Game *game,
+                       int opening_x, int opening_y) {
+    if (recorder->file == NULL) {
+        return;
+    }
+
+    put_record_start(recorder, RECORD_START);
+    put_bytes(recorder, game->width, 2);
+    put_bytes(recorder, game->height, 2);
+    put_bytes(recorder, game->mine_count, 4);
+    put_bytes(recorder, game->seed, 8);
+    put_bytes(recorder, (opening_x < 0 ? RECORD_NO_OPENING : opening_x), 2);
+    put_bytes(recorder, (opening_y < 0 ? RECORD_NO_OPENING : opening_y), 2);
+    recorder->in_game = 1;
+}
+
+/*
+ * Record a click on cell x, y with button, before the game responds to it.
+ * Only left and right clicks (buttons 1 and 2) change the game, so other
+ * buttons are not recorded
+ */
+void record_click(struct Recorder *recorder, int x, int y, int button) {
+    if (recorder->file == NULL || !recorder->in_game ||
+        (button != 1 && button != 2)) {
+        return;
+    }
+
+    put_record_start(recorder, RECORD_CLICK);
+    put_bytes(recorder, button, 1);
+    put_bytes(recorder, x, 2);
+    put_bytes(recorder, y, 2);
+}
+
+/*
+ * Record the end of the game, or that recording of it stopped, with the hash
+ * of its board. The recording is flushed, so that every game recorded before
+ * a crash is kept
+ */
+void record_game_end(struct Recorder *recorder, struct Game *game) {
+    if (recorder->file == NULL || !recorder->in_game) {
+        return;
+    }
+
+    put_record_start(recorder, RECORD_END);
+    put_bytes(recorder, hash_game(game), 8);
+    recorder->in_game = 0;
+
+    fflush(recorder->file);
+    check_recorder(recorder);
+}
+
+/*
+ * Return the size of a record of type, including its type and time, or 0 if
+ * the type is not valid
+ */
+static int record_size(int type) {
+    switch (type) {
+        case RECORD_START:
+            return 25;
+        case RECORD_CLICK:
+            return 10;
+        case RECORD_END:
+            return 13;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Decode the record at data into event
+ */
+static void decode_record(const unsigned char *data,
+                          struct RecordedEvent *event) {
+    memset(event, 0, sizeof(*event));
+    event->type = data[0];
+    event->time_ms = get_bytes(data + 1, 4);
+    data += 5;
+
+    if (event->type == RECORD_START) {
+        event->width = get_bytes(data, 2);
+        event->height = get_bytes(data + 2, 2);
+        event->mine_count = get_bytes(data + 4, 4);
+        event->seed = get_bytes(data + 8, 8);
+        event->x = get_bytes(data + 16, 2);
+        event->y = get_bytes(data + 18, 2);
+        if (event->x == RECORD_NO_OPENING || event->y == RECORD_NO_OPENING) {
+            event->x = -1;
+            event->y = -1;
+        }
+    }
+    else if (event->type == RECORD_CLICK) {
+        event->button = data[0];
+        event->x = get_bytes(data + 1, 2);
+        event->y = get_bytes(data + 3, 2);
+    }
+    else {
+        event->hash = get_bytes(data, 8);
+    }
+}
+
+/*
+ * Read the whole recording at path into memory, decoded into events. Return 1
+ * if successful, 0 otherwise
+ */
+int load_recording(struct Recording *recording, const char *path) {
+    recording->events = NULL;
+    recording->event_count = 0;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        print_error("Failed to open %s", path);
+        return 0;
+    }
+
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+    unsigned char *data = (size >= 0 ? malloc(size + 1) : NULL);
+    int ok = (data != NULL && fseek(file, 0, SEEK_SET) == 0 &&
+              fread(data, 1, size, file) == (size_t) size);
+    fclose(file);
+    if (!ok) {
+        print_error("Failed to read %s", path);
+        free(data);
+        return 0;
+    }
+
+    if (size < (long) RECORDING_HEADER_SIZE ||
+        memcmp(data, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0) {
+        print_error("Not a minesweeper recording");
+        free(data);
+        return 0;
+    }
+    if (get_bytes(data + sizeof(RECORDING_MAGIC), 4) != RECORDING_VERSION) {
+        print_error("Unsupported recording version");
+        free(data);
+        return 0;
+    }
+
+    // Check every record and count them, so that the events are allocated
+    // once
+    int count = 0;
+    long offset = RECORDING_HEADER_SIZE;
+    while (offset < size) {
+        int record = record_size(data[offset]);
+        if (record == 0 || offset + record > size) {
+            print_error("Recording is corrupt at byte %ld", offset);
+            free(data);
+            return 0;
+        }
+        offset += record;
+        count++;
+    }
+
+    recording->events = malloc(sizeof(struct RecordedEvent) * (count + 1));
+    if (recording->events == NULL) {
+        print_error("Failed to allocate memory for the recording");
+        free(data);
+        return 0;
+    }
+
+    offset = RECORDING_HEADER_SIZE;
+    for (int i=0; i<count; i++) {
+        decode_record(data + offset, &(recording->events[i]));
+        offset += record_size(data[offset]);
+    }
+    recording->event_count = count;
+
+    free(data);
+    return 1;
+}
+
+/*
+ * Free the events of a recording read by load_recording()
+ */
+void free_recording(struct Recording *recording) {
+    free(recording->events);
+    recording->events = NULL;
+    recording->event_count = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "minesweeper.h"
+
+#define RECORDING_MAGIC "MINEREC"
+#define RECORDING_VERSION 1
+
+// The types of record in a recording
+#define RECORD_START 1
+#define RECORD_CLICK 2
+#define RECORD_END 3
+
+// The opening coordinates of a game that started without one
+#define RECORD_NO_OPENING 0xffff
+
+/*
+ * Writes the input of games to a recording, so that they can be replayed.
+ * A recording is RECORDING_MAGIC with its terminating NUL and a 32-bit
+ * version, followed by records. Every record starts with its type (1 byte)
+ * and the time since recording began in ms (4 bytes), followed by:
+ *   RECORD_START  width, height (2 bytes each), mine count (4 bytes), seed
+ *                 (8 bytes), and the cell revealed when the game started,
+ *                 x, y (2 bytes each, RECORD_NO_OPENING if none)
+ *   RECORD_CLICK  button (1 byte), cell x, y (2 bytes each)
+ *   RECORD_END    hash_game() of the board (8 bytes)
+ * Every field is an unsigned little-endian integer. The board of every game
+ * can be made again from its seed, so the recording is only ever a few bytes
+ * per click
+ */
+struct Recorder {
+    FILE *file;  // NULL if nothing is being recorded
+    struct timespec start;
+
+    // Whether a game has been started since the last RECORD_END, so that its
+    // clicks are recorded
+    int in_game;
+};
+
+/*
+ * A record read back from a recording
+ */
+struct RecordedEvent {
+    int type;
+    uint32_t time_ms;
+
+    // RECORD_START
+    int width;
+    int height;
+    int mine_count;
+    uint64_t seed;
+
+    // RECORD_START: the opening, or -1 if there is none. RECORD_CLICK: the
+    // cell clicked
+    int x;
+    int y;
+
+    int button;     // RECORD_CLICK
+    uint64_t hash;  // RECORD_END
+};
+
+struct Recording {
+    struct RecordedEvent *events;
+    int event_count;
+};
+
+int open_recorder(struct Recorder *recorder, const char *path);
+void close_recorder(struct Recorder *recorder);
+void record_game_start(struct Recorder *recorder, struct Game *game,
+                       int opening_x, int opening_y);
+void record_click(struct Recorder *recorder, int x, int y, int button);
+void record_game_end(struct Recorder *recorder, struct Game *game);
+int load_recording(struct Recording *recording, const char *path);
+void free_recording(struct Recording *recording);
+
+#endif
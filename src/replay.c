@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "minesweeper.h"
+#include "recording.h"
+#include "generator.h"
+#include "threadpool.h"
+#include "rng.h"
+#include "error.h"
+
+/*
+ * Tool: replay a recording made with `minesweeper --record FILE` through the
+ * engine as fast as possible, check that every game ends with the same board
+ * as it did when it was recorded, and time the replay. Once the first pass has
+ * grown the arena to the biggest board, the later passes must not allocate
+ * any memory. Recordings hold the seed of each board rather than generating
+ * it, so no-guess generation is checked separately, by starting no-guess
+ * games on each preset in turn
+ */
+
+// The presets the game generates no-guess boards for (width, height, mines),
+// the time it gives each one, and how many times to start each preset
+#define NO_GUESS_PRESET_COUNT 3
+#define NO_GUESS_TIME_BUDGET 0.1
+#define NO_GUESS_ROUNDS 3
+
+const int no_guess_presets[NO_GUESS_PRESET_COUNT][3] = {
+    {8, 8, 10},
+    {16, 16, 30},
+    {30, 16, 99}
+};
+
+// The number of calls made to the allocation functions. The tool is linked
+// with -Wl,--wrap for each of them (see the Makefile), so that every call from
+// the tool and the engine library comes through the wrappers below
+long allocation_count = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *memory, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocation_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocation_count++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *memory, size_t size) {
+    allocation_count++;
+    return __real_realloc(memory, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size) {
+    allocation_count++;
+    return __real_aligned_alloc(alignment, size);
+}
+
+/*
+ * The totals of one pass over a recording
+ */
+struct ReplayStats {
+    int games;
+    int clicks;
+    long cells_revealed;
+    int checked;     // Games whose final board was checked
+    int mismatches;  // Games whose final board differed
+};
+
+/*
+ * Return the current time in seconds from a monotonic clock
+ */
+double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Set up game for a recorded RECORD_START in arena, as the game does. Return 1
+ * if successful, 0 otherwise
+ */
+int start_recorded_game(struct Game *game, struct Arena *arena,
+                        const struct RecordedEvent *event) {
+    if (!init_game_in_arena(game, arena, event->width, event->height,
+                            event->mine_count, event->seed)) {
+        return 0;
+    }
+
+    // This places the mines the same way the game did
+    if (event->x >= 0) {
+        reset_game_with_opening(game, event->seed, event->x, event->y);
+        click_cell(game, event->x, event->y, 1);
+    }
+    clear_dirty_cells(game);
+    return 1;
+}
+
+/*
+ * Replay every event of a recording, as the game responded to them. With
+ * verify set, the board at the end of each game is compared with the one
+ * recorded. Return 1 if successful, 0 otherwise
+ */
+int replay(const struct Recording *recording, struct Game *game,
+           struct Arena *arena, int verify, struct ReplayStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int in_game = 0;
+
+    for (int i=0; i<recording->event_count; i++) {
+        const struct RecordedEvent *event = &(recording->events[i]);
+
+        if (event->type == RECORD_START) {
+            if (!start_recorded_game(game, arena, event)) {
+                return 0;
+            }
+            in_game = 1;
+            stats->games++;
+        }
+        else if (event->type == RECORD_CLICK && in_game) {
+            click_cell(game, event->x, event->y, event->button);
+
+            // The game draws the cells that changed and clears the list
+            clear_dirty_cells(game);
+            stats->clicks++;
+        }
+        else if (event->type == RECORD_END && in_game) {
+            stats->cells_revealed += game->cells_revealed;
+            if (verify) {
+                stats->checked++;
+                if (hash_game(game) != event->hash) {
+                    stats->mismatches++;
+                    fprintf(stderr, "game %d: board differs from the "
+                            "recording (%016" PRIx64 " != %016" PRIx64 ")\n",
+                            stats->games, hash_game(game), event->hash);
+                }
+            }
+            in_game = 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Start no-guess games on each preset in turn, NO_GUESS_ROUNDS times, as the
+ * game does when the player switches between presets. The first round grows
+ * the generator and the arenas to the biggest preset. Return the number of
+ * allocations made after the first round, or -1 if a game could not be
+ * started
+ */
+long count_no_guess_allocations() {
+    struct ThreadPool pool;
+    if (!init_thread_pool(&pool, 0)) {
+        return -1;
+    }
+
+    struct Generator generator;
+    memset(&generator, 0, sizeof(generator));
+    struct Arena arena;
+    init_arena(&arena);
+    struct Game game;
+    struct Rng rng;
+    rng_seed(&rng, 1);
+
+    int ok = 1;
+    long allocations_before = 0;
+    for (int round=0; ok && round<NO_GUESS_ROUNDS; round++) {
+        if (round == 1) {
+            allocations_before = allocation_count;
+        }
+
+        for (int i=0; ok && i<NO_GUESS_PRESET_COUNT; i++) {
+            int width = no_guess_presets[i][0];
+            int height = no_guess_presets[i][1];
+            uint64_t seed = rng_next(&rng);
+
+            // As start_game() in the game does
+            if (generator.capacity < width * height) {
+                free_generator(&generator);
+                ok = init_generator(&generator, width * height, &pool);
+            }
+            struct GeneratorResult result;
+            ok = ok && init_game_in_arena(&game, &arena, width, height,
+                                          no_guess_presets[i][2], seed) &&
+                 generate_no_guess_game(&generator, &game, seed, width / 2,
+                                        height / 2, NO_GUESS_TIME_BUDGET,
+                                        &result);
+            if (ok) {
+                reveal_cell(&game, width / 2, height / 2);
+            }
+        }
+    }
+    long allocations = (ok ? allocation_count - allocations_before : -1);
+
+    free_generator(&generator);
+    free_arena(&arena);
+    free_thread_pool(&pool);
+    return allocations;
+}
+
+void print_usage() {
+    fprintf(stderr, "usage: minesweeper-replay [--repeat N] FILE\n");
+}
+
+int main(int argc, char **args) {
+    const char *path = NULL;
+    int repeat = 10;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(args[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(args[++i]);
+        }
+        else if (path == NULL && args[i][0] != '-') {
+            path = args[i];
+        }
+        else {
+            print_usage();
+            exit_app(EXIT_FAILURE);
+        }
+    }
+
+    if (path == NULL || repeat < 1) {
+        print_usage();
+        exit_app(EXIT_FAILURE);
+    }
+
+    // The whole recording is decoded up front, so that only the engine is
+    // timed
+    struct Recording recording;
+    if (!load_recording(&recording, path)) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    struct Game game;
+    struct Arena arena;
+    init_arena(&arena);
+    struct ReplayStats stats;
+    if (!replay(&recording, &game, &arena, 1, &stats)) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    // Then it is replayed again without the checks, keeping the fastest pass
+    // and counting the allocations made
+    long allocations_before = allocation_count;
+    double best = -1;
+    for (int i=0; i<repeat; i++) {
+        struct ReplayStats pass;
+        double start = get_time();
+        replay(&recording, &game, &arena, 0, &pass);
+        double elapsed = get_time() - start;
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    long allocations = allocation_count - allocations_before;
+
+    long no_guess_allocations = count_no_guess_allocations();
+    if (no_guess_allocations < 0) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    printf("games:            %d (%d checked)\n", stats.games, stats.checked);
+    printf("clicks:           %d\n", stats.clicks);
+    printf("cells revealed:   %ld\n", stats.cells_revealed);
+    printf("mismatches:       %d\n", stats.mismatches);
+    printf("replay:           %.3f ms, %.1f ns/click (best of %d)\n",
+           best * 1e3, (stats.clicks > 0 ? best * 1e9 / stats.clicks : 0),
+           repeat);
+    printf("allocations:      %ld after the first pass\n", allocations);
+    printf("no-guess starts:  %ld allocations after the first round\n",
+           no_guess_allocations);
+
+    free_arena(&arena);
+    free_recording(&recording);
+
+    if (allocations != 0) {
+        print_error("Replaying allocated memory after warming up");
+        return EXIT_FAILURE;
+    }
+    if (no_guess_allocations != 0) {
+        print_error("Starting no-guess games allocated memory after warming "
+                    "up");
+        return EXIT_FAILURE;
+    }
+    return (stats.mismatches == 0 ? 0 : EXIT_FAILURE);
+}
@@ -0,0 +1,68 @@
+#include <stdint.h>
+
+#include "rng.h"
+
+/*
+ * Advance a splitmix64 state and return the next output. This is used to
+ * expand a single 64-bit seed into a full xoshiro256** state
+ */
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Seed the generator. The same seed always produces the same sequence
+ */
+void rng_seed(struct Rng *rng, uint64_t seed) {
+    for (int i=0; i<4; i++) {
+        rng->state[i] = splitmix64(&seed);
+    }
+}
+
+/*
+ * Rotate x left by k bits
+ */
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/*
+ * Return the next 64 random bits from the generator (xoshiro256**)
+ */
+uint64_t rng_next(struct Rng *rng) {
+    uint64_t *s = rng->state;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/*
+ * Return a uniformly distributed random number in [0, bound). This uses
+ * Lemire's multiply-and-shift method, rejecting the few values that would
+ * bias the result
+ */
+uint64_t rng_below(struct Rng *rng, uint64_t bound) {
+    __uint128_t m = (__uint128_t) rng_next(rng) * bound;
+    uint64_t low = (uint64_t) m;
+
+    if (low < bound) {
+        uint64_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (__uint128_t) rng_next(rng) * bound;
+            low = (uint64_t) m;
+        }
+    }
+
+    return m >> 64;
+}
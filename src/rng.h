@@ -0,0 +1,16 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// State for a xoshiro256** pseudo-random number generator
+struct Rng {
+    uint64_t state[4];
+};
+
+uint64_t splitmix64(uint64_t *state);
+void rng_seed(struct Rng *rng, uint64_t seed);
+uint64_t rng_next(struct Rng *rng);
+uint64_t rng_below(struct Rng *rng, uint64_t bound);
+
+#endif
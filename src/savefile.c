@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "minesweeper.h"
+#include "savefile.h"
+#include "error.h"
+
+// The size of the buffer that save files are written through. This must be a
+// multiple of SAVE_ALIGNMENT
+#define SAVE_BUFFER_SIZE 65536
+
+/*
+ * A save file being written. The sections are written through a buffer, and
+ * their checksum is updated as the buffer is flushed
+ */
+struct SaveWriter {
+    FILE *file;
+    uint64_t checksum;
+    uint64_t offset;  // The offset in the file of the end of the buffer
+    size_t used;      // The number of bytes in the buffer
+    int ok;
+    unsigned char buffer[SAVE_BUFFER_SIZE];
+};
+
+/*
+ * Round size up to a multiple of SAVE_ALIGNMENT
+ */
+static uint64_t align_size(uint64_t size) {
+    return (size + SAVE_ALIGNMENT - 1) / SAVE_ALIGNMENT * SAVE_ALIGNMENT;
+}
+
+/*
+ * Continue checksum over size bytes of data, which must be a multiple of 8.
+ * Each 8-byte word is mixed in with a rotate and a multiply by an odd
+ * constant, which are both reversible, so changing any one word always
+ * changes the result
+ */
+uint64_t save_checksum(uint64_t checksum, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i=0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        checksum = (((checksum << 31) | (checksum >> 33)) ^ word) *
+                   0x9e3779b97f4a7c15;
+    }
+    return checksum;
+}
+
+/*
+ * Return the checksum of a header, which covers every field before
+ * header_checksum
+ */
+static uint64_t header_checksum(const struct SaveHeader *header) {
+    return save_checksum(0, header, offsetof(struct SaveHeader,
+                                             header_checksum));
+}
+
+/*
+ * Set the sizes and offsets of the sections in a header from the board's
+ * dimensions and mine count. The sections follow the header in order, each
+ * starting on a multiple of SAVE_ALIGNMENT. Return the size of the file
+ */
+static uint64_t set_save_layout(struct SaveHeader *header) {
+    uint64_t cell_count = (uint64_t) header->width * header->height;
+
+    header->cells_offset = align_size(sizeof(struct SaveHeader));
+    header->cells_size = (uint64_t) (header->width + 2) * (header->height + 2);
+    header->mine_bits_offset = align_size(header->cells_offset +
+                                          header->cells_size);
+    header->mine_bits_size = (cell_count + 63) / 64 * sizeof(uint64_t);
+    header->mines_offset = align_size(header->mine_bits_offset +
+                                      header->mine_bits_size);
+    header->mines_size = header->mine_count * sizeof(int);
+
+    return align_size(header->mines_offset + header->mines_size);
+}
+
+/*
+ * Write the buffered bytes to the file
+ */
+static void flush_writer(struct SaveWriter *writer) {
+    writer->checksum = save_checksum(writer->checksum, writer->buffer,
+                                     writer->used);
+    if (fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) {
+        writer->ok = 0;
+    }
+    writer->used = 0;
+}
+
+/*
+ * Write size bytes of data, with mask applied to every byte
+ */
+static void write_masked(struct SaveWriter *writer, const void *data,
+                         size_t size, unsigned char mask) {
+    const unsigned char *bytes = data;
+    while (size > 0) {
+        size_t count = SAVE_BUFFER_SIZE - writer->used;
+        count = (count < size ? count : size);
+
+        unsigned char *out = writer->buffer + writer->used;
+        for (size_t i=0; i<count; i++) {
+            out[i] = bytes[i] & mask;
+        }
+
+        writer->used += count;
+        writer->offset += count;
+        bytes += count;
+        size -= count;
+        if (writer->used == SAVE_BUFFER_SIZE) {
+            flush_writer(writer);
+        }
+    }
+}
+
+/*
+ * Write zeros up to the next multiple of SAVE_ALIGNMENT
+ */
+static void pad_writer(struct SaveWriter *writer) {
+    static const unsigned char zeros[SAVE_ALIGNMENT];
+    write_masked(writer, zeros, align_size(writer->offset) - writer->offset,
+                 0);
+}
+
+/*
+ * Write a game to a save file at path. The file is written under a temporary
+ * name and then renamed, so an existing save is only replaced once the new
+ * one is complete. Return 1 if successful, 0 otherwise
+ */
+int save_game(struct Game *game, const char *path) {
+    struct SaveHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SAVE_MAGIC, sizeof(header.magic));
+    header.version = SAVE_VERSION;
+    header.byte_order = SAVE_BYTE_ORDER;
+    header.header_size = sizeof(header);
+    header.width = game->width;
+    header.height = game->height;
+    header.mine_count = game->mine_count;
+    header.cells_revealed = game->cells_revealed;
+    header.flags_remaining = game->flags_remaining;
+    header.mine_exploded = game->mine_exploded;
+    header.elapsed_seconds = time(NULL) - game->timestamp;
+    header.seed = game->seed;
+    memcpy(header.rng_state, game->rng.state, sizeof(header.rng_state));
+    set_save_layout(&header);
+
+    char *temp_path = malloc(strlen(path) + 5);
+    struct SaveWriter *writer = malloc(sizeof(struct SaveWriter));
+    if (temp_path == NULL || writer == NULL) {
+        print_error("Failed to allocate memory to save the game");
+        free(temp_path);
+        free(writer);
+        return 0;
+    }
+    sprintf(temp_path, "%s.tmp", path);
+
+    writer->file = fopen(temp_path, "wb");
+    if (writer->file == NULL) {
+        print_error("Failed to create %s", temp_path);
+        free(temp_path);
+        free(writer);
+        return 0;
+    }
+
+    // The header is written again at the end, once the checksum is known
+    writer->ok = (fwrite(&header, sizeof(header), 1, writer->file) == 1);
+    writer->checksum = 0;
+    writer->offset = sizeof(header);
+    writer->used = 0;
+    while (writer->offset < header.cells_offset) {
+        writer->ok &= (fputc(0, writer->file) != EOF);
+        writer->offset++;
+    }
+
+    // Whether a cell has been drawn is not part of the game
+    write_masked(writer, game->cells - game->stride - 1, header.cells_size,
+                 (unsigned char) ~CELL_DIRTY);
+    pad_writer(writer);
+    write_masked(writer, game->mine_bits, header.mine_bits_size, 0xff);
+    pad_writer(writer);
+    write_masked(writer, game->mines, header.mines_size, 0xff);
+    pad_writer(writer);
+    flush_writer(writer);
+
+    header.data_checksum = writer->checksum;
+    header.header_checksum = header_checksum(&header);
+    writer->ok &= (fseek(writer->file, 0, SEEK_SET) == 0 &&
+                   fwrite(&header, sizeof(header), 1, writer->file) == 1);
+    writer->ok &= (fclose(writer->file) == 0);
+
+    int ok = writer->ok;
+    if (!ok) {
+        print_error("Failed to write %s", temp_path);
+        remove(temp_path);
+    }
+    else if (rename(temp_path, path) != 0) {
+        print_error("Failed to replace %s", path);
+        remove(temp_path);
+        ok = 0;
+    }
+
+    free(temp_path);
+    free(writer);
+    return ok;
+}
+
+/*
+ * Check that a header is one this version can load, and that it describes a
+ * valid board laid out the way save_game() writes it in a file of file_size
+ * bytes. Return 1 if it is, otherwise print why not and return 0
+ */
+static int check_header(const struct SaveHeader *header, uint64_t file_size) {
+    if (memcmp(header->magic, SAVE_MAGIC, sizeof(header->magic)) != 0) {
+        print_error("Not a minesweeper save file");
+        return 0;
+    }
+    if (header->byte_order != SAVE_BYTE_ORDER) {
+        print_error("Save file is from a machine with a different byte order");
+        return 0;
+    }
+    if (header->version != SAVE_VERSION ||
+        header->header_size != sizeof(struct SaveHeader)) {
+        print_error("Unsupported save file version %u", header->version);
+        return 0;
+    }
+    if (header->header_checksum != header_checksum(header)) {
+        print_error("Save file header is corrupt");
+        return 0;
+    }
+
+    if (header->width < 1 || header->width > MAX_WIDTH ||
+        header->height < 1 || header->height > MAX_HEIGHT ||
+        header->mine_count < 0 ||
+        header->mine_count > header->width * header->height) {
+        print_error("Save file has an invalid board size");
+        return 0;
+    }
+
+    struct SaveHeader layout = *header;
+    uint64_t size = set_save_layout(&layout);
+    if (memcmp(&layout, header, sizeof(layout)) != 0 || size != file_size) {
+        print_error("Save file has an invalid layout");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Read and check the header of the save file at path. Return 1 if it is
+ * valid, 0 otherwise
+ */
+int read_save_header(const char *path, struct SaveHeader *header) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        print_error("Failed to open %s", path);
+        return 0;
+    }
+
+    int ok = (fread(header, sizeof(*header), 1, file) == 1 &&
+              fseek(file, 0, SEEK_END) == 0);
+    long size = ftell(file);
+    fclose(file);
+    if (!ok || size < 0) {
+        print_error("Failed to read %s", path);
+        return 0;
+    }
+
+    return check_header(header, size);
+}
+
+/*
+ * Check the parts of a mapped save that keep the engine inside the board: the
+ * border around the grid must be all sentinels, or a reveal would walk off
+ * the grid, and each mine must be a cell of the board. This only reads the
+ * perimeter and the mines, so it is done on every load. Return 1 if they are
+ * valid, 0 otherwise
+ */
+static int check_bounds(const struct SaveHeader *header,
+                        const unsigned char *mapping) {
+    const unsigned char *cells = mapping + header->cells_offset;
+    int stride = header->width + 2;
+    int last_row = (header->height + 1) * stride;
+    for (int x=0; x<stride; x++) {
+        if (cells[x] != CELL_SENTINEL ||
+            cells[last_row + x] != CELL_SENTINEL) {
+            return 0;
+        }
+    }
+    for (int y=1; y<=header->height; y++) {
+        if (cells[y * stride] != CELL_SENTINEL ||
+            cells[y * stride + stride - 1] != CELL_SENTINEL) {
+            return 0;
+        }
+    }
+
+    const int *mines = (const int *) (mapping + header->mines_offset);
+    for (int i=0; i<header->mine_count; i++) {
+        if (mines[i] < 0 || mines[i] >= header->width * header->height) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Check that the cells of a mapped save agree with its mines: each cell's
+ * CELL_MINE bit must match the bitset, the bitset must hold exactly the cells
+ * in mines[] with none repeated, and no cell may be dirty or count more than
+ * 8 mines. The bitset is cleared as the mines are matched to it and then
+ * rebuilt, which is fine as the mapping is private. Return 1 if they agree, 0
+ * otherwise
+ */
+static int check_mines(const struct SaveHeader *header,
+                       unsigned char *mapping) {
+    const unsigned char *cells = mapping + header->cells_offset;
+    uint64_t *mine_bits = (uint64_t *) (mapping + header->mine_bits_offset);
+    const int *mines = (const int *) (mapping + header->mines_offset);
+    int stride = header->width + 2;
+
+    for (int y=0; y<header->height; y++) {
+        const unsigned char *row = cells + (y + 1) * stride + 1;
+        for (int x=0; x<header->width; x++) {
+            int position = x + y * header->width;
+            int is_mine = (mine_bits[position / 64] >> (position % 64)) & 1;
+            if (((row[x] & CELL_MINE) != 0) != is_mine ||
+                (row[x] & CELL_DIRTY) || (row[x] & CELL_COUNT_MASK) > 8) {
+                return 0;
+            }
+        }
+    }
+
+    for (int i=0; i<header->mine_count; i++) {
+        uint64_t bit = (uint64_t) 1 << (mines[i] % 64);
+        if (!(mine_bits[mines[i] / 64] & bit)) {
+            return 0;
+        }
+        mine_bits[mines[i] / 64] &= ~bit;
+    }
+    // Any bits left are mines missing from mines[], or bits past the board
+    int words = header->mine_bits_size / sizeof(uint64_t);
+    for (int i=0; i<words; i++) {
+        if (mine_bits[i] != 0) {
+            return 0;
+        }
+    }
+    for (int i=0; i<header->mine_count; i++) {
+        mine_bits[mines[i] / 64] |= (uint64_t) 1 << (mines[i] % 64);
+    }
+    return 1;
+}
+
+/*
+ * Load a game saved by save_game(). The file is mapped into memory privately,
+ * so the game's cells and mines are used where they are in the file and only
+ * read from disk as they are touched, and changes to them are not written
+ * back. Unless verify_data is set, only the header, the border of the grid
+ * and the mines are checked, so this takes time in proportion to the
+ * perimeter and the mine count rather than the area. With verify_data, the
+ * checksum of the whole file is checked too, and that the cells agree with
+ * the mines. Return 1 if successful, 0 otherwise
+ */
+int load_game(struct Game *game, const char *path, int verify_data) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        print_error("Failed to open %s", path);
+        return 0;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+        info.st_size < (off_t) sizeof(struct SaveHeader)) {
+        print_error("Failed to read %s", path);
+        close(fd);
+        return 0;
+    }
+
+    size_t size = info.st_size;
+    unsigned char *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        print_error("Failed to map %s", path);
+        return 0;
+    }
+
+    const struct SaveHeader *header = (const struct SaveHeader *) mapping;
+    if (!check_header(header, size)) {
+        munmap(mapping, size);
+        return 0;
+    }
+
+    int ok = check_bounds(header, mapping);
+    if (ok && verify_data) {
+        uint64_t checksum = save_checksum(0, mapping + header->cells_offset,
+                                          size - header->cells_offset);
+        ok = (checksum == header->data_checksum &&
+              check_mines(header, mapping));
+    }
+    if (!ok) {
+        print_error("Save file is corrupt");
+        munmap(mapping, size);
+        return 0;
+    }
+
+    set_grid_size(game, header->width, header->height);
+    game->mine_count = header->mine_count;
+    game->cells = mapping + header->cells_offset + game->stride + 1;
+    game->mine_bits = (uint64_t *) (mapping + header->mine_bits_offset);
+    game->mines = (int *) (mapping + header->mines_offset);
+    game->mapping = mapping;
+    game->mapping_size = size;
+    game->arena = NULL;
+
+    game->cells_revealed = header->cells_revealed;
+    game->flags_remaining = header->flags_remaining;
+    game->mine_exploded = header->mine_exploded;
+    game->timestamp = time(NULL) - header->elapsed_seconds;
+    game->seed = header->seed;
+    memcpy(game->rng.state, header->rng_state, sizeof(game->rng.state));
+
+    // These are only work space, so they are not saved
+    game->count_plane = malloc(header->cells_size);
+    game->reveal_stack = malloc(sizeof(int) * game->width * game->height);
+    game->dirty_cells = malloc(sizeof(int) * game->width * game->height);
+    game->dirty_count = 0;
+    if (game->count_plane == NULL || game->reveal_stack == NULL ||
+        game->dirty_cells == NULL) {
+        print_error("Failed to allocate memory for the game");
+        free_game(game);
+        return 0;
+    }
+
+    return 1;
+}
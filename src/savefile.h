@@ -0,0 +1,66 @@
+#ifndef SAVEFILE_H
+#define SAVEFILE_H
+
+#include <stdint.h>
+
+#include "minesweeper.h"
+
+#define SAVE_MAGIC "MINESAVE"
+#define SAVE_VERSION 1
+
+// Written as a native integer, so that a file from a machine with the other
+// byte order can be recognised
+#define SAVE_BYTE_ORDER 0x01020304
+
+// Every section of a save file starts on a multiple of this many bytes
+#define SAVE_ALIGNMENT 64
+
+/*
+ * The header at the start of a save file. The sections it points to are laid
+ * out exactly as struct Game holds them in memory, so a saved game can be
+ * mapped into memory and played without reading or copying the board:
+ *   cells      the cells including their border, (width + 2) * (height + 2)
+ *              bytes, with no CELL_DIRTY bits set
+ *   mine_bits  the mine bitset, one bit per cell
+ *   mines      the positions of the mines, as ints
+ * Each is padded with zeros to SAVE_ALIGNMENT bytes, and so is the header
+ */
+struct SaveHeader {
+    char magic[8];  // SAVE_MAGIC, without a terminating NUL
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;  // sizeof(struct SaveHeader)
+
+    int32_t width;
+    int32_t height;
+    int32_t mine_count;
+    int32_t cells_revealed;
+    int32_t flags_remaining;
+    int32_t mine_exploded;
+    int32_t reserved;  // Zero
+
+    int64_t elapsed_seconds;  // The time played so far
+    uint64_t seed;
+    uint64_t rng_state[4];
+
+    // The position of each section from the start of the file, and its size
+    // in bytes without padding
+    uint64_t cells_offset;
+    uint64_t cells_size;
+    uint64_t mine_bits_offset;
+    uint64_t mine_bits_size;
+    uint64_t mines_offset;
+    uint64_t mines_size;
+
+    // save_checksum() of everything after the header's padding, and of the
+    // header up to header_checksum
+    uint64_t data_checksum;
+    uint64_t header_checksum;
+};
+
+uint64_t save_checksum(uint64_t checksum, const void *data, size_t size);
+int save_game(struct Game *game, const char *path);
+int read_save_header(const char *path, struct SaveHeader *header);
+int load_game(struct Game *game, const char *path, int verify_data);
+
+#endif
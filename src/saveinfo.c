@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "minesweeper.h"
+#include "savefile.h"
+#include "error.h"
+
+/*
+ * Tool: print the header of a save file written by the game, and check the
+ * checksum of the rest of it. Exits with a failure status if the file is not
+ * valid
+ */
+
+int main(int argc, char **args) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: minesweeper-saveinfo FILE\n");
+        return EXIT_FAILURE;
+    }
+
+    struct SaveHeader header;
+    if (!read_save_header(args[1], &header)) {
+        return EXIT_FAILURE;
+    }
+
+    printf("version:          %u\n", header.version);
+    printf("board:            %dx%d, %d mines\n", header.width, header.height,
+           header.mine_count);
+    printf("seed:             %" PRIu64 "\n", header.seed);
+    printf("cells revealed:   %d\n", header.cells_revealed);
+    printf("flags remaining:  %d\n", header.flags_remaining);
+    printf("mine exploded:    %s\n", (header.mine_exploded ? "yes" : "no"));
+    printf("elapsed:          %" PRId64 "s\n", header.elapsed_seconds);
+    printf("cells:            %" PRIu64 " bytes at %" PRIu64 "\n",
+           header.cells_size, header.cells_offset);
+    printf("mine bitset:      %" PRIu64 " bytes at %" PRIu64 "\n",
+           header.mine_bits_size, header.mine_bits_offset);
+    printf("mine positions:   %" PRIu64 " bytes at %" PRIu64 "\n",
+           header.mines_size, header.mines_offset);
+    printf("header checksum:  %016" PRIx64 "\n", header.header_checksum);
+    printf("data checksum:    %016" PRIx64 "\n", header.data_checksum);
+
+    // Loading with the data checked reads the whole file
+    struct Game game;
+    if (!load_game(&game, args[1], 1)) {
+        return EXIT_FAILURE;
+    }
+    free_game(&game);
+    printf("data:             ok\n");
+
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "minesweeper.h"
+#include "solver.h"
+#include "probability.h"
+#include "threadpool.h"
+#include "rng.h"
+#include "error.h"
+
+// Games are handed out to workers in chunks of this many
+#define CHUNK_GAMES 64
+
+// Guess counts of this or more share the last histogram bucket
+#define MAX_GUESS_BUCKET 16
+
+#define CACHE_LINE_SIZE 64
+
+struct SimOptions {
+    int width;
+    int height;
+    int mine_count;
+    long game_count;
+    uint64_t seed;
+    int thread_count;  // 0 means one per core
+    int use_probabilities;
+    int json;
+};
+
+/*
+ * Totals over a set of games. These are all integers, so adding up the totals
+ * of each worker gives the same result whichever worker played which game
+ */
+struct SimStats {
+    long games;
+    long wins;
+    long no_guess_wins;  // Games won without guessing
+    long guesses;
+    long safe_reveals;
+    long flags_placed;
+    long guess_histogram[MAX_GUESS_BUCKET + 1];
+};
+
+/*
+ * A worker's range of chunks that have not been played yet. The worker takes
+ * chunks from the front, and idle workers steal half of what is left from the
+ * back. Each queue is on its own cache line so workers do not slow each other
+ * down by taking chunks
+ */
+struct WorkQueue {
+    pthread_mutex_t lock;
+    long begin;
+    long end;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*
+ * Everything a worker uses to play games, reused for every game it plays
+ */
+struct Worker {
+    struct Game game;
+    struct Solver solver;
+    struct ProbabilityEngine probability;
+    struct SimStats stats;
+};
+
+struct Sim {
+    struct SimOptions *options;
+    long chunk_count;
+    int worker_count;
+    struct WorkQueue *queues;
+    struct Worker *workers;
+};
+
+/*
+ * Return the current time in seconds from a monotonic clock
+ */
+double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Take the next chunk from a worker's own queue, or steal half of the
+ * remaining chunks of another worker if it has none. Return the chunk, or -1
+ * if every queue is empty. Only one lock is held at a time, so workers
+ * stealing from each other cannot deadlock
+ */
+long take_chunk(struct Sim *sim, int worker) {
+    struct WorkQueue *own = &(sim->queues[worker]);
+
+    pthread_mutex_lock(&(own->lock));
+    if (own->begin < own->end) {
+        long chunk = own->begin++;
+        pthread_mutex_unlock(&(own->lock));
+        return chunk;
+    }
+    pthread_mutex_unlock(&(own->lock));
+
+    for (int i=1; i<sim->worker_count; i++) {
+        struct WorkQueue *victim = &(sim->queues[(worker + i) %
+                                                 sim->worker_count]);
+
+        pthread_mutex_lock(&(victim->lock));
+        long remaining = victim->end - victim->begin;
+        if (remaining <= 0) {
+            pthread_mutex_unlock(&(victim->lock));
+            continue;
+        }
+        long stolen = (remaining + 1) / 2;
+        long begin = victim->end - stolen;
+        victim->end = begin;
+        pthread_mutex_unlock(&(victim->lock));
+
+        // Keep the first stolen chunk and queue the rest, where they can be
+        // stolen in turn
+        pthread_mutex_lock(&(own->lock));
+        own->begin = begin + 1;
+        own->end = begin + stolen;
+        pthread_mutex_unlock(&(own->lock));
+        return begin;
+    }
+
+    return -1;
+}
+
+/*
+ * Play one game, identified by its index in the run, and add it to the
+ * worker's totals. The board and the solver's guesses are seeded from the
+ * run's seed and the index alone, so each game plays out the same way
+ * whichever worker plays it
+ */
+void play_game(struct Sim *sim, struct Worker *worker, long index) {
+    uint64_t state = sim->options->seed + index * 0x9e3779b97f4a7c15ULL;
+    uint64_t game_seed = splitmix64(&state);
+    struct Rng rng;
+    rng_seed(&rng, splitmix64(&state));
+
+    if (!reset_game(&(worker->game), game_seed)) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    struct SolverResult result;
+    solver_play(&(worker->solver), &(worker->game), &rng, &result);
+
+    struct SimStats *stats = &(worker->stats);
+    stats->games++;
+    stats->wins += result.won;
+    stats->no_guess_wins += (result.won && result.guesses == 0);
+    stats->guesses += result.guesses;
+    stats->safe_reveals += result.safe_reveals;
+    stats->flags_placed += result.flags_placed;
+    stats->guess_histogram[result.guesses < MAX_GUESS_BUCKET ?
+                           result.guesses : MAX_GUESS_BUCKET]++;
+}
+
+/*
+ * Thread pool task: play chunks until there are none left anywhere
+ */
+void run_worker(void *context, int index, int thread) {
+    struct Sim *sim = context;
+    struct Worker *worker = &(sim->workers[index]);
+    long game_count = sim->options->game_count;
+
+    while (1) {
+        long chunk = take_chunk(sim, index);
+        if (chunk < 0) {
+            break;
+        }
+
+        long end = (chunk + 1) * CHUNK_GAMES;
+        for (long i=chunk * CHUNK_GAMES; i<end && i<game_count; i++) {
+            play_game(sim, worker, i);
+        }
+    }
+}
+
+/*
+ * Set up a worker's game and solver. Return 1 if successful, 0 otherwise
+ */
+int init_worker(struct Worker *worker, struct SimOptions *options) {
+    memset(worker, 0, sizeof(*worker));
+    int cells = options->width * options->height;
+
+    if (!init_game(&(worker->game), options->width, options->height,
+                   options->mine_count, options->seed) ||
+        !init_solver(&(worker->solver), cells)) {
+        return 0;
+    }
+
+    // Each worker already has a core to itself, so the probability engines
+    // do not share a pool
+    if (options->use_probabilities) {
+        if (!init_probability_engine(&(worker->probability), cells, NULL)) {
+            return 0;
+        }
+        worker->solver.probability = &(worker->probability);
+    }
+
+    return 1;
+}
+
+void free_worker(struct Worker *worker) {
+    free_game(&(worker->game));
+    free_solver(&(worker->solver));
+    free_probability_engine(&(worker->probability));
+}
+
+void add_stats(struct SimStats *total, struct SimStats *stats) {
+    total->games += stats->games;
+    total->wins += stats->wins;
+    total->no_guess_wins += stats->no_guess_wins;
+    total->guesses += stats->guesses;
+    total->safe_reveals += stats->safe_reveals;
+    total->flags_placed += stats->flags_placed;
+    for (int i=0; i<=MAX_GUESS_BUCKET; i++) {
+        total->guess_histogram[i] += stats->guess_histogram[i];
+    }
+}
+
+void print_text(struct SimOptions *options, struct SimStats *stats,
+                int thread_count, double elapsed) {
+    double games = (stats->games > 0 ? stats->games : 1);
+
+    printf("Played %ld games of %dx%d with %d mines (seed %llu, %d threads)\n\n",
+           stats->games, options->width, options->height, options->mine_count,
+           (unsigned long long) options->seed, thread_count);
+    printf("win rate           %.4f\n", stats->wins / games);
+    printf("no-guess win rate  %.4f\n", stats->no_guess_wins / games);
+    printf("guesses per game   %.4f\n", stats->guesses / games);
+    printf("safe reveals/game  %.4f\n", stats->safe_reveals / games);
+    printf("flags per game     %.4f\n", stats->flags_placed / games);
+    printf("games/s            %.0f\n", stats->games / elapsed);
+    printf("elapsed            %.3f s\n\n", elapsed);
+
+    printf("guesses     games  fraction\n");
+    for (int i=0; i<=MAX_GUESS_BUCKET; i++) {
+        printf("%2d%-5s %10ld  %.4f\n", i, (i == MAX_GUESS_BUCKET ? "+" : ""),
+               stats->guess_histogram[i], stats->guess_histogram[i] / games);
+    }
+}
+
+void print_json(struct SimOptions *options, struct SimStats *stats,
+                int thread_count, double elapsed) {
+    double games = (stats->games > 0 ? stats->games : 1);
+
+    printf("{\n");
+    printf("  \"width\": %d,\n", options->width);
+    printf("  \"height\": %d,\n", options->height);
+    printf("  \"mine_count\": %d,\n", options->mine_count);
+    printf("  \"seed\": %llu,\n", (unsigned long long) options->seed);
+    printf("  \"threads\": %d,\n", thread_count);
+    printf("  \"probabilities\": %s,\n",
+           (options->use_probabilities ? "true" : "false"));
+    printf("  \"games\": %ld,\n", stats->games);
+    printf("  \"wins\": %ld,\n", stats->wins);
+    printf("  \"no_guess_wins\": %ld,\n", stats->no_guess_wins);
+    printf("  \"guesses\": %ld,\n", stats->guesses);
+    printf("  \"safe_reveals\": %ld,\n", stats->safe_reveals);
+    printf("  \"flags_placed\": %ld,\n", stats->flags_placed);
+    printf("  \"win_rate\": %.6f,\n", stats->wins / games);
+    printf("  \"guesses_per_game\": %.6f,\n", stats->guesses / games);
+    printf("  \"games_per_second\": %.0f,\n", stats->games / elapsed);
+    printf("  \"elapsed\": %.6f,\n", elapsed);
+    printf("  \"guess_histogram\": [");
+    for (int i=0; i<=MAX_GUESS_BUCKET; i++) {
+        printf("%ld%s", stats->guess_histogram[i],
+               (i < MAX_GUESS_BUCKET ? ", " : ""));
+    }
+    printf("]\n");
+    printf("}\n");
+}
+
+void print_usage() {
+    fprintf(stderr,
+            "usage: minesweeper-sim [--width W] [--height H] [--mines M] "
+            "[--games N] [--seed S] [--threads T] [--probability] [--json]\n");
+}
+
+int main(int argc, char **args) {
+    // Expert by default
+    struct SimOptions options;
+    options.width = 30;
+    options.height = 16;
+    options.mine_count = 99;
+    options.game_count = 1000000;
+    options.seed = 1;
+    options.thread_count = 0;
+    options.use_probabilities = 0;
+    options.json = 0;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(args[i], "--width") == 0 && i + 1 < argc) {
+            options.width = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--height") == 0 && i + 1 < argc) {
+            options.height = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--mines") == 0 && i + 1 < argc) {
+            options.mine_count = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--games") == 0 && i + 1 < argc) {
+            options.game_count = atol(args[++i]);
+        }
+        else if (strcmp(args[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = strtoull(args[++i], NULL, 10);
+        }
+        else if (strcmp(args[i], "--threads") == 0 && i + 1 < argc) {
+            options.thread_count = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--probability") == 0) {
+            options.use_probabilities = 1;
+        }
+        else if (strcmp(args[i], "--json") == 0) {
+            options.json = 1;
+        }
+        else {
+            print_usage();
+            exit_app(EXIT_FAILURE);
+        }
+    }
+
+    if (options.game_count < 0 || options.thread_count < 0) {
+        print_usage();
+        exit_app(EXIT_FAILURE);
+    }
+
+    struct ThreadPool pool;
+    if (!init_thread_pool(&pool, options.thread_count)) {
+        exit_app(EXIT_FAILURE);
+    }
+
+    // Split the chunks evenly between the workers to start with
+    struct Sim sim;
+    sim.options = &options;
+    sim.chunk_count = (options.game_count + CHUNK_GAMES - 1) / CHUNK_GAMES;
+    sim.worker_count = pool.thread_count;
+    sim.queues = aligned_alloc(CACHE_LINE_SIZE,
+                               sizeof(struct WorkQueue) * sim.worker_count);
+    sim.workers = malloc(sizeof(struct Worker) * sim.worker_count);
+    if (sim.queues == NULL || sim.workers == NULL) {
+        print_error("Failed to allocate memory for the workers");
+        exit_app(EXIT_FAILURE);
+    }
+
+    for (int i=0; i<sim.worker_count; i++) {
+        pthread_mutex_init(&(sim.queues[i].lock), NULL);
+        sim.queues[i].begin = sim.chunk_count * i / sim.worker_count;
+        sim.queues[i].end = sim.chunk_count * (i + 1) / sim.worker_count;
+        if (!init_worker(&(sim.workers[i]), &options)) {
+            exit_app(EXIT_FAILURE);
+        }
+    }
+
+    double start = get_time();
+    thread_pool_run(&pool, sim.worker_count, run_worker, &sim);
+    double elapsed = get_time() - start;
+
+    struct SimStats total;
+    memset(&total, 0, sizeof(total));
+    for (int i=0; i<sim.worker_count; i++) {
+        add_stats(&total, &(sim.workers[i].stats));
+    }
+
+    if (options.json) {
+        print_json(&options, &total, sim.worker_count, elapsed);
+    }
+    else {
+        print_text(&options, &total, sim.worker_count, elapsed);
+    }
+
+    for (int i=0; i<sim.worker_count; i++) {
+        free_worker(&(sim.workers[i]));
+        pthread_mutex_destroy(&(sim.queues[i].lock));
+    }
+    free(sim.workers);
+    free(sim.queues);
+    free_thread_pool(&pool);
+
+    return 0;
+}
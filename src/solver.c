@@ -0,0 +1,577 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "minesweeper.h"
+#include "solver.h"
+#include "probability.h"
+#include "rng.h"
+#include "error.h"
+
+// The largest number of neighbours a cell can have
+#define MAX_NEIGHBOURS 8
+
+// Guesses whose mine probabilities differ by less than this are equally good
+#define PROBABILITY_TOLERANCE 1e-9
+
+/*
+ * The solver only looks at what the player can see: the values returned by
+ * get_cell(), the size of the board and the number of flags remaining. It
+ * assumes that every flag on the board is on a mine, which is always true for
+ * flags that it placed itself
+ */
+
+/*
+ * Allocate scratch space for solving boards of up to cell_count cells. Return
+ * 1 if successful, 0 otherwise
+ */
+int init_solver(struct Solver *solver, int cell_count) {
+    solver->capacity = cell_count;
+    solver->queue = malloc(sizeof(int) * cell_count);
+    solver->queued = calloc(cell_count, 1);
+    solver->stamps = calloc(cell_count, sizeof(int));
+    solver->walk = malloc(sizeof(int) * cell_count);
+    solver->candidates = malloc(sizeof(int) * cell_count);
+    solver->frontier = malloc(sizeof(int) * cell_count);
+    solver->frontier_index = malloc(sizeof(int) * cell_count);
+    solver->frontier_unknown = malloc(sizeof(int) * cell_count * MAX_NEIGHBOURS);
+    solver->frontier_unknown_count = malloc(cell_count);
+    solver->frontier_mines = malloc(cell_count);
+    solver->probabilities = malloc(sizeof(double) * cell_count);
+    solver->probability = NULL;
+    solver->queue_size = 0;
+    solver->stamp = 0;
+
+    if (solver->queue == NULL || solver->queued == NULL ||
+        solver->stamps == NULL || solver->walk == NULL ||
+        solver->candidates == NULL || solver->frontier == NULL ||
+        solver->frontier_index == NULL || solver->frontier_unknown == NULL ||
+        solver->frontier_unknown_count == NULL ||
+        solver->frontier_mines == NULL || solver->probabilities == NULL) {
+        print_error("Failed to allocate memory for the solver");
+        free_solver(solver);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Free the scratch space allocated by init_solver()
+ */
+void free_solver(struct Solver *solver) {
+    free(solver->queue);
+    free(solver->queued);
+    free(solver->stamps);
+    free(solver->walk);
+    free(solver->candidates);
+    free(solver->frontier);
+    free(solver->frontier_index);
+    free(solver->frontier_unknown);
+    free(solver->frontier_unknown_count);
+    free(solver->frontier_mines);
+    free(solver->probabilities);
+    memset(solver, 0, sizeof(*solver));
+}
+
+/*
+ * Store the positions of the cells adjacent to position in neighbours and
+ * their player-visible values in values, and return how many there are
+ */
+static int get_neighbours(struct Game *game, int position, int *neighbours,
+                          int *values) {
+    int x = position % game->width;
+    int y = position / game->width;
+    int count = 0;
+
+    for (int ny=y - 1; ny<=y + 1; ny++) {
+        if (ny < 0 || ny >= game->height) {
+            continue;
+        }
+        for (int nx=x - 1; nx<=x + 1; nx++) {
+            if (nx < 0 || nx >= game->width || (nx == x && ny == y)) {
+                continue;
+            }
+            neighbours[count] = nx + ny * game->width;
+            values[count++] = decode_cell(game->cells[nx + ny * game->stride]);
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Return the player-visible value of the cell at position. Loops over the
+ * whole board read the cells row by row instead, to avoid the division in
+ * cell_index()
+ */
+static int visible_value(struct Game *game, int position) {
+    return decode_cell(game->cells[cell_index(game, position)]);
+}
+
+/*
+ * For a numbered cell, store its unknown neighbours in unknown and return how
+ * many there are. The number of mines among them (i.e. the number on the cell
+ * minus the adjacent flags) is stored in mines_ptr
+ */
+static int get_unknown_neighbours(struct Game *game, int position,
+                                  int *unknown, int *mines_ptr) {
+    int neighbours[MAX_NEIGHBOURS];
+    int values[MAX_NEIGHBOURS];
+    int neighbour_count = get_neighbours(game, position, neighbours, values);
+    int mines = visible_value(game, position);
+    int count = 0;
+
+    for (int i=0; i<neighbour_count; i++) {
+        int value = values[i];
+        if (value == CELL_TYPE_UNKNOWN) {
+            unknown[count++] = neighbours[i];
+        }
+        else if (value == CELL_TYPE_FLAG) {
+            mines--;
+        }
+    }
+
+    *mines_ptr = mines;
+    return count;
+}
+
+/*
+ * Add a numbered cell to the queue of cells to examine, if it is not already
+ * in it
+ */
+static void enqueue(struct Solver *solver, int position) {
+    if (!solver->queued[position]) {
+        solver->queued[position] = 1;
+        solver->queue[solver->queue_size++] = position;
+    }
+}
+
+/*
+ * Add any numbered cells adjacent to position to the queue
+ */
+static void enqueue_neighbours(struct Solver *solver, struct Game *game,
+                               int position) {
+    int neighbours[MAX_NEIGHBOURS];
+    int values[MAX_NEIGHBOURS];
+    int count = get_neighbours(game, position, neighbours, values);
+    for (int i=0; i<count; i++) {
+        if (values[i] > 0) {
+            enqueue(solver, neighbours[i]);
+        }
+    }
+}
+
+/*
+ * Queue the cells that need to be looked at again after position has been
+ * revealed. If it opened up an area with no adjacent mines then every cell in
+ * that area is new, so walk through the area and queue the numbered cells
+ * around its edge
+ */
+static void enqueue_revealed(struct Solver *solver, struct Game *game,
+                             int position) {
+    if (visible_value(game, position) != CELL_TYPE_NO_MINES) {
+        enqueue(solver, position);
+        enqueue_neighbours(solver, game, position);
+        return;
+    }
+
+    solver->stamp++;
+    solver->stamps[position] = solver->stamp;
+    int walk_size = 0;
+    solver->walk[walk_size++] = position;
+
+    while (walk_size > 0) {
+        int current = solver->walk[--walk_size];
+        int neighbours[MAX_NEIGHBOURS];
+        int values[MAX_NEIGHBOURS];
+        int count = get_neighbours(game, current, neighbours, values);
+
+        for (int i=0; i<count; i++) {
+            int neighbour = neighbours[i];
+            if (solver->stamps[neighbour] == solver->stamp) {
+                continue;
+            }
+
+            int value = values[i];
+            if (value == CELL_TYPE_NO_MINES) {
+                solver->stamps[neighbour] = solver->stamp;
+                solver->walk[walk_size++] = neighbour;
+            }
+            else if (value > 0) {
+                solver->stamps[neighbour] = solver->stamp;
+                enqueue(solver, neighbour);
+            }
+        }
+    }
+}
+
+/*
+ * Reveal a cell that is known to be safe
+ */
+static void reveal_safe(struct Solver *solver, struct Game *game, int position,
+                        struct SolverResult *result) {
+    if (visible_value(game, position) != CELL_TYPE_UNKNOWN) {
+        return;
+    }
+
+    reveal_cell(game, position % game->width, position / game->width);
+    result->safe_reveals++;
+
+    if (!lost_game(game)) {
+        enqueue_revealed(solver, game, position);
+    }
+}
+
+/*
+ * Flag a cell that is known to contain a mine
+ */
+static void flag_mine(struct Solver *solver, struct Game *game, int position,
+                      struct SolverResult *result) {
+    if (visible_value(game, position) != CELL_TYPE_UNKNOWN) {
+        return;
+    }
+
+    toggle_flag(game, position % game->width, position / game->width);
+    result->flags_placed++;
+    enqueue_neighbours(solver, game, position);
+}
+
+/*
+ * Apply the single-cell rules to a numbered cell: if all of its mines have
+ * been flagged then its other unknown neighbours are safe, and if it has as
+ * many unknown neighbours as unflagged mines then they are all mines. Return
+ * the number of moves made
+ */
+static int apply_single_rules(struct Solver *solver, struct Game *game,
+                              int position, struct SolverResult *result) {
+    int unknown[MAX_NEIGHBOURS];
+    int mines;
+    int count = get_unknown_neighbours(game, position, unknown, &mines);
+
+    if (count == 0 || (mines != 0 && mines != count)) {
+        return 0;
+    }
+
+    for (int i=0; i<count && !lost_game(game); i++) {
+        if (mines == 0) {
+            reveal_safe(solver, game, unknown[i], result);
+        }
+        else {
+            flag_mine(solver, game, unknown[i], result);
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Return 1 if value is one of the count values in list, 0 otherwise
+ */
+static int contains(int *list, int count, int value) {
+    for (int i=0; i<count; i++) {
+        if (list[i] == value) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Apply the pair rule to two numbered cells a and b, given their unknown
+ * neighbours and the number of unflagged mines among them. Let only_a be the
+ * unknown cells next to a but not b, and only_b the other way round. If a
+ * needs |only_a| more mines than b, then every cell in only_a must be a mine
+ * and every cell in only_b must be safe. This includes the subset rule, where
+ * only_a is empty. Return the number of moves made
+ */
+static int apply_pair_rule(struct Solver *solver, struct Game *game,
+                           int *unknown_a, int count_a, int mines_a,
+                           int *unknown_b, int count_b, int mines_b,
+                           struct SolverResult *result) {
+    int only_a[MAX_NEIGHBOURS];
+    int only_b[MAX_NEIGHBOURS];
+    int only_a_count = 0;
+    int only_b_count = 0;
+    for (int i=0; i<count_a; i++) {
+        if (!contains(unknown_b, count_b, unknown_a[i])) {
+            only_a[only_a_count++] = unknown_a[i];
+        }
+    }
+
+    // The cells must share at least one unknown cell for the rule to say
+    // anything the single-cell rules do not
+    if (only_a_count == count_a || mines_a - mines_b != only_a_count) {
+        return 0;
+    }
+
+    for (int i=0; i<count_b; i++) {
+        if (!contains(unknown_a, count_a, unknown_b[i])) {
+            only_b[only_b_count++] = unknown_b[i];
+        }
+    }
+    if (only_a_count + only_b_count == 0) {
+        return 0;
+    }
+
+    for (int i=0; i<only_a_count; i++) {
+        flag_mine(solver, game, only_a[i], result);
+    }
+    for (int i=0; i<only_b_count && !lost_game(game); i++) {
+        reveal_safe(solver, game, only_b[i], result);
+    }
+
+    return only_a_count + only_b_count;
+}
+
+/*
+ * Look for a pair of nearby numbered cells on the frontier (i.e. with unknown
+ * neighbours) that the pair rule can be applied to, and apply it to the first
+ * one found. The unknown neighbours of every frontier cell are collected once
+ * up front, which is valid until the first move is made. Return the number of
+ * moves made
+ */
+static int apply_pair_rules(struct Solver *solver, struct Game *game,
+                            struct SolverResult *result) {
+    solver->stamp++;
+    int frontier_count = 0;
+
+    for (int y=0; y<game->height; y++) {
+        const unsigned char *row = game->cells + y * game->stride;
+        for (int x=0; x<game->width; x++) {
+            if (decode_cell(row[x]) <= 0) {
+                continue;
+            }
+
+            int i = x + y * game->width;
+            int *unknown = solver->frontier_unknown +
+                           frontier_count * MAX_NEIGHBOURS;
+            int mines;
+            int count = get_unknown_neighbours(game, i, unknown, &mines);
+            if (count > 0) {
+                solver->frontier[frontier_count] = i;
+                solver->frontier_unknown_count[frontier_count] = count;
+                solver->frontier_mines[frontier_count] = mines;
+                solver->frontier_index[i] = frontier_count;
+                solver->stamps[i] = solver->stamp;
+                frontier_count++;
+            }
+        }
+    }
+
+    for (int ia=0; ia<frontier_count; ia++) {
+        // Only cells within 2 of a can share an unknown neighbour with it
+        int x = solver->frontier[ia] % game->width;
+        int y = solver->frontier[ia] / game->width;
+        for (int by=y - 2; by<=y + 2; by++) {
+            for (int bx=x - 2; bx<=x + 2; bx++) {
+                if (bx < 0 || bx >= game->width || by < 0 ||
+                    by >= game->height || (bx == x && by == y)) {
+                    continue;
+                }
+
+                int b = bx + by * game->width;
+                if (solver->stamps[b] != solver->stamp) {
+                    continue;
+                }
+
+                int ib = solver->frontier_index[b];
+                int moves = apply_pair_rule(
+                    solver, game,
+                    solver->frontier_unknown + ia * MAX_NEIGHBOURS,
+                    solver->frontier_unknown_count[ia],
+                    solver->frontier_mines[ia],
+                    solver->frontier_unknown + ib * MAX_NEIGHBOURS,
+                    solver->frontier_unknown_count[ib],
+                    solver->frontier_mines[ib], result);
+                if (moves > 0) {
+                    return moves;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Apply the rules that use the total number of mines: if every mine has been
+ * flagged then all unknown cells are safe, and if there are exactly as many
+ * unknown cells as unflagged mines then they are all mines. Return the number
+ * of moves made
+ */
+static int apply_global_rules(struct Solver *solver, struct Game *game,
+                              struct SolverResult *result) {
+    int count = 0;
+    for (int y=0; y<game->height; y++) {
+        const unsigned char *row = game->cells + y * game->stride;
+        for (int x=0; x<game->width; x++) {
+            if (decode_cell(row[x]) == CELL_TYPE_UNKNOWN) {
+                solver->candidates[count++] = x + y * game->width;
+            }
+        }
+    }
+
+    if (count == 0 ||
+        (game->flags_remaining != 0 && game->flags_remaining != count)) {
+        return 0;
+    }
+
+    int mines = game->flags_remaining;
+    for (int i=0; i<count && !lost_game(game); i++) {
+        if (mines == 0) {
+            reveal_safe(solver, game, solver->candidates[i], result);
+        }
+        else {
+            flag_mine(solver, game, solver->candidates[i], result);
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Reveal safe cells and flag mines for as long as they can be found by logic
+ * alone, using the single-cell rules, then the pair rule and then the global
+ * rules when the cheaper rules run out. Stop when stuck or when the game is
+ * over. Return the number of moves made
+ */
+int solver_run(struct Solver *solver, struct Game *game,
+               struct SolverResult *result) {
+    if (solver->capacity < game->width * game->height) {
+        print_error("Solver is too small for the board");
+        return 0;
+    }
+
+    int cell_count = game->width * game->height;
+    memset(solver->queued, 0, cell_count);
+    solver->queue_size = 0;
+
+    for (int y=0; y<game->height; y++) {
+        const unsigned char *row = game->cells + y * game->stride;
+        for (int x=0; x<game->width; x++) {
+            if (decode_cell(row[x]) > 0) {
+                enqueue(solver, x + y * game->width);
+            }
+        }
+    }
+
+    int total_moves = 0;
+    while (!won_game(game) && !lost_game(game)) {
+        while (solver->queue_size > 0 && !lost_game(game)) {
+            int position = solver->queue[--solver->queue_size];
+            solver->queued[position] = 0;
+            total_moves += apply_single_rules(solver, game, position, result);
+        }
+
+        if (won_game(game) || lost_game(game)) {
+            break;
+        }
+
+        int moves = apply_pair_rules(solver, game, result);
+        if (moves == 0) {
+            moves = apply_global_rules(solver, game, result);
+        }
+        if (moves == 0) {
+            break;
+        }
+        total_moves += moves;
+    }
+
+    return total_moves;
+}
+
+/*
+ * Choose a cell to reveal when the solver is stuck. If the solver has a
+ * probability engine, then the cell least likely to be a mine is chosen,
+ * otherwise any unknown cell. Ties are broken with rng. safe is set to 1 if
+ * the cell is certain not to be a mine. Return its position, or -1 if there
+ * are no unknown cells
+ */
+static int choose_guess(struct Solver *solver, struct Game *game,
+                        struct Rng *rng, int *safe) {
+    int use_probabilities = (solver->probability != NULL &&
+                             compute_probabilities(solver->probability, game,
+                                                   solver->probabilities));
+
+    // Collect the unknown cells, then keep those least likely to be a mine
+    int count = 0;
+    double best = 1;
+    for (int y=0; y<game->height; y++) {
+        const unsigned char *row = game->cells + y * game->stride;
+        for (int x=0; x<game->width; x++) {
+            if (decode_cell(row[x]) != CELL_TYPE_UNKNOWN) {
+                continue;
+            }
+            int i = x + y * game->width;
+            solver->candidates[count++] = i;
+            if (use_probabilities && solver->probabilities[i] < best) {
+                best = solver->probabilities[i];
+            }
+        }
+    }
+
+    if (use_probabilities) {
+        int kept = 0;
+        for (int i=0; i<count; i++) {
+            if (solver->probabilities[solver->candidates[i]] <=
+                best + PROBABILITY_TOLERANCE) {
+                solver->candidates[kept++] = solver->candidates[i];
+            }
+        }
+        count = kept;
+    }
+
+    *safe = (use_probabilities && best <= 0);
+    if (count == 0) {
+        return -1;
+    }
+    return solver->candidates[rng_below(rng, count)];
+}
+
+/*
+ * Play a game to the end: solve as far as possible by logic, guess when stuck
+ * and repeat. The first click and any guesses are chosen with rng, so the
+ * same game and rng state always play out the same way. The outcome and the
+ * number of guesses are stored in result. If the solver is too small for the
+ * board, nothing is played and the game counts as lost
+ */
+void solver_play(struct Solver *solver, struct Game *game, struct Rng *rng,
+                 struct SolverResult *result) {
+    memset(result, 0, sizeof(*result));
+
+    // solver_run() would give up without making a move, which would look like
+    // being stuck, and choose_guess() would then overrun the candidates
+    if (solver->capacity < game->width * game->height) {
+        print_error("Solver is too small for the board");
+        return;
+    }
+
+    int first_move = (game->cells_revealed == 0);
+    while (!won_game(game) && !lost_game(game)) {
+        if (solver_run(solver, game, result) > 0) {
+            continue;
+        }
+        if (won_game(game) || lost_game(game)) {
+            break;
+        }
+
+        int safe;
+        int position = choose_guess(solver, game, rng, &safe);
+        if (position < 0) {
+            break;
+        }
+
+        if (safe) {
+            result->safe_reveals++;
+        }
+        else if (!first_move) {
+            result->guesses++;
+        }
+        first_move = 0;
+
+        reveal_cell(game, position % game->width, position / game->width);
+    }
+
+    result->won = won_game(game);
+}
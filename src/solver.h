@@ -0,0 +1,63 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "minesweeper.h"
+#include "rng.h"
+#include "probability.h"
+
+/*
+ * Scratch space for the solver. This is sized for the largest board it will be
+ * used on, so one solver can be reused for many games without allocating
+ */
+struct Solver {
+    int capacity;  // The number of cells the scratch arrays have room for
+
+    // Stack of revealed, numbered cells that need to be examined
+    int *queue;
+    int queue_size;
+    unsigned char *queued;
+
+    // Used to walk through openings without visiting a cell twice. A cell has
+    // been visited if its stamp equals the current stamp
+    int *stamps;
+    int stamp;
+    int *walk;
+
+    // The cells that a guess can be chosen from
+    int *candidates;
+
+    // The numbered cells with unknown neighbours, and for each one its unknown
+    // neighbours (MAX_NEIGHBOURS per cell) and unflagged adjacent mines.
+    // frontier_index maps a cell position to its index in frontier
+    int *frontier;
+    int *frontier_index;
+    int *frontier_unknown;
+    unsigned char *frontier_unknown_count;
+    signed char *frontier_mines;
+
+    // If not NULL, guesses are chosen by exact mine probability instead of at
+    // random. This is set by the caller, and can be shared by solvers that are
+    // not used at the same time
+    struct ProbabilityEngine *probability;
+    double *probabilities;
+};
+
+struct SolverResult {
+    int won;
+
+    // The number of cells revealed without being certain that they were safe,
+    // not counting the first click
+    int guesses;
+
+    int safe_reveals;  // The number of cells revealed by deduction
+    int flags_placed;  // The number of mines found by deduction
+};
+
+int init_solver(struct Solver *solver, int cell_count);
+void free_solver(struct Solver *solver);
+int solver_run(struct Solver *solver, struct Game *game,
+               struct SolverResult *result);
+void solver_play(struct Solver *solver, struct Game *game, struct Rng *rng,
+                 struct SolverResult *result);
+
+#endif
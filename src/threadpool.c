@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "threadpool.h"
+#include "error.h"
+
+/*
+ * The arguments passed to each worker thread
+ */
+struct WorkerArgs {
+    struct ThreadPool *pool;
+    int worker;
+};
+
+/*
+ * Return the number of online CPU cores, or 1 if it cannot be found
+ */
+int get_core_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0 ? count : 1);
+}
+
+/*
+ * Take tasks from the current batch and run them until there are none left
+ */
+static void run_tasks(struct ThreadPool *pool, int worker) {
+    while (1) {
+        int index = __atomic_fetch_add(&(pool->next_task), 1, __ATOMIC_RELAXED);
+        if (index >= pool->task_count) {
+            break;
+        }
+        pool->function(pool->context, index, worker);
+    }
+}
+
+/*
+ * The main function of each worker thread: wait for a batch, help run it, and
+ * report back when done
+ */
+static void *worker_main(void *arg) {
+    struct WorkerArgs *args = arg;
+    struct ThreadPool *pool = args->pool;
+    int worker = args->worker;
+    free(args);
+
+    int batch = 0;
+    pthread_mutex_lock(&(pool->lock));
+    while (1) {
+        while (pool->batch == batch && !pool->shutdown) {
+            pthread_cond_wait(&(pool->batch_ready), &(pool->lock));
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        batch = pool->batch;
+        pthread_mutex_unlock(&(pool->lock));
+
+        run_tasks(pool, worker);
+
+        pthread_mutex_lock(&(pool->lock));
+        pool->workers_busy--;
+        if (pool->workers_busy == 0) {
+            pthread_cond_signal(&(pool->batch_done));
+        }
+    }
+    pthread_mutex_unlock(&(pool->lock));
+
+    return NULL;
+}
+
+/*
+ * Start a pool with the specified number of threads (including the calling
+ * thread), or one per core if thread_count is 0. Return 1 if successful, 0
+ * otherwise
+ */
+int init_thread_pool(struct ThreadPool *pool, int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = get_core_count();
+    }
+
+    pool->thread_count = thread_count;
+    pool->threads = malloc(sizeof(pthread_t) * thread_count);
+    pool->task_count = 0;
+    pool->next_task = 0;
+    pool->workers_busy = 0;
+    pool->batch = 0;
+    pool->shutdown = 0;
+
+    if (pool->threads == NULL) {
+        print_error("Failed to allocate memory for the thread pool");
+        return 0;
+    }
+
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->batch_ready), NULL);
+    pthread_cond_init(&(pool->batch_done), NULL);
+
+    // Thread 0 is the caller of thread_pool_run(), so only start the others
+    for (int i=1; i<thread_count; i++) {
+        struct WorkerArgs *args = malloc(sizeof(struct WorkerArgs));
+        args->pool = pool;
+        args->worker = i;
+        if (pthread_create(&(pool->threads[i]), NULL, worker_main, args) != 0) {
+            print_error("Failed to start worker thread");
+            free(args);
+            pool->thread_count = i;
+            free_thread_pool(pool);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Stop the worker threads and free the pool
+ */
+void free_thread_pool(struct ThreadPool *pool) {
+    pthread_mutex_lock(&(pool->lock));
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&(pool->batch_ready));
+    pthread_mutex_unlock(&(pool->lock));
+
+    for (int i=1; i<pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&(pool->lock));
+    pthread_cond_destroy(&(pool->batch_ready));
+    pthread_cond_destroy(&(pool->batch_done));
+    free(pool->threads);
+    pool->threads = NULL;
+}
+
+/*
+ * Run function for every task index in [0, task_count), spread across the
+ * pool, and return once they have all finished
+ */
+void thread_pool_run(struct ThreadPool *pool, int task_count,
+                     TaskFunction function, void *context) {
+    if (pool->thread_count == 1 || task_count == 1) {
+        for (int i=0; i<task_count; i++) {
+            function(context, i, 0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->lock));
+    pool->function = function;
+    pool->context = context;
+    pool->task_count = task_count;
+    pool->next_task = 0;
+    pool->workers_busy = pool->thread_count - 1;
+    pool->batch++;
+    pthread_cond_broadcast(&(pool->batch_ready));
+    pthread_mutex_unlock(&(pool->lock));
+
+    run_tasks(pool, 0);
+
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->workers_busy > 0) {
+        pthread_cond_wait(&(pool->batch_done), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+}
@@ -0,0 +1,43 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+/*
+ * A function run by the pool for each task. index is the task number, and
+ * worker is the number of the thread running it, in [0, thread_count), which
+ * can be used to index per-thread scratch space
+ */
+typedef void (*TaskFunction)(void *context, int index, int worker);
+
+/*
+ * A fixed set of worker threads that run batches of tasks. The thread that
+ * submits a batch also works on it as worker 0, so a pool with a thread_count
+ * of 1 runs everything on the calling thread
+ */
+struct ThreadPool {
+    int thread_count;
+    pthread_t *threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t batch_ready;
+    pthread_cond_t batch_done;
+
+    // The current batch
+    TaskFunction function;
+    void *context;
+    int task_count;
+    int next_task;
+    int workers_busy;
+    int batch;
+
+    int shutdown;
+};
+
+int get_core_count();
+int init_thread_pool(struct ThreadPool *pool, int thread_count);
+void free_thread_pool(struct ThreadPool *pool);
+void thread_pool_run(struct ThreadPool *pool, int task_count,
+                     TaskFunction function, void *context);
+
+#endif